@@ -834,6 +834,21 @@ GSArgsFind(gs_args *Args, char *Wanted)
         return(-1);
 }
 
+int /* Returns -1 if Arg not found. Unlike GSArgsFind, Wanted must be the whole arg. */
+GSArgsFindExact(gs_args *Args, char *Wanted)
+{
+        int StringLength = GSStringLength(Wanted);
+        for(int I=0; I<Args->Count; I++)
+        {
+                /* Matching the terminator too rules out longer args. */
+                if(GSStringIsEqual(Wanted, Args->Args[I], StringLength + 1))
+                {
+                        return(I);
+                }
+        }
+        return(-1);
+}
+
 char * /* Returns NULL if Index is invalid. */
 GSArgsAtIndex(gs_args *Args, int Index)
 {
@@ -854,6 +869,16 @@ GSArgsAfter(gs_args *Args, char *Marker)
         return(Arg);
 }
 
+char * /* Returns NULL if Marker is not found or no trailing arg. */
+GSArgsAfterExact(gs_args *Args, char *Marker)
+{
+        int Index = GSArgsFindExact(Args, Marker);
+        if(Index < 0) return(NULL);
+
+        char *Arg = GSArgsAtIndex(Args, Index + 1);
+        return(Arg);
+}
+
 gs_bool
 GSArgsHelpWanted(gs_args *Args)
 {
@@ -1,11 +1,33 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <alloca.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
 
 #include <editline/readline.h>
 #include <editline/history.h>
 
 #include "gs.h"
+
+/* Allocation tracking provides mpc's allocation hooks, so it needs their declarations. */
+#if defined(LISPY_ALLOC_STATS) && !defined(MPC_ALLOC_HOOKS)
+#define MPC_ALLOC_HOOKS
+#endif
 #include "mpc.h"
 
 #define LASSERT(Args, Condition, Error)         \
@@ -17,744 +39,6407 @@
 
 struct lval;
 struct lenv;
+struct llambda;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct llambda llambda;
 typedef lval *(*lbuiltin)(lenv *, lval *);
 
+/*
+ * One entry per registered builtin. Function values point at their entry, so
+ * dispatch can update the counters without looking anything up.
+ */
+struct lbuiltin_info
+{
+        char *Name;
+        lbuiltin Function;
+
+        /* Result depends only on the arguments, so calls can be memoized. */
+        gs_bool IsPure;
+
+        /* The C function's name, so --emit-c can call it directly. */
+        char *CName;
+
+        unsigned long long Calls;
+        unsigned long long Cells;
+        unsigned long long Ticks;
+};
+typedef struct lbuiltin_info lbuiltin_info;
+
 /******************************************************************************
- * lval Type and Functions
+ * Timing
  ******************************************************************************/
 
-struct lval
+unsigned long long
+ClockNanoseconds(void)
 {
-        /* Type of value. */
-        int Type;
+        struct timespec Now;
+        clock_gettime(CLOCK_MONOTONIC, &Now);
+        return((unsigned long long)Now.tv_sec * 1000000000ULL + Now.tv_nsec);
+}
 
-        /* Value for given type. Think of as union. */
-        long Number;
-        char *Error;
-        char *Symbol;
-        lbuiltin Function;
+/*
+ * Ticks are the cheapest monotonic count available: the TSC on x86, otherwise
+ * nanoseconds. Use ClockTicksToNanoseconds to convert deltas for reporting.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define ClockTicks() ((unsigned long long)__rdtsc())
+#else
+#define ClockTicks() ClockNanoseconds()
+#endif
 
-        /* If this is an S/Q-Expression, then track the cells. */
-        unsigned int CellCount;
-        struct lval **Cell;
-};
+static unsigned long long ClockBaseTicks;
+static unsigned long long ClockBaseNanoseconds;
 
-enum lval_type_e
+/* Records the reference point that tick rates are measured from. */
+void
+ClockInit(void)
 {
-        LVAL_TYPE_NUMBER,
-        LVAL_TYPE_ERROR,
-        LVAL_TYPE_SYMBOL,
-        LVAL_TYPE_FUNCTION,
-        LVAL_TYPE_SEXPRESSION,
-        LVAL_TYPE_QEXPRESSION
-};
+        ClockBaseNanoseconds = ClockNanoseconds();
+        ClockBaseTicks = ClockTicks();
+}
 
-enum lval_error_e
+/* Calibrated against the time since ClockInit, waiting until at least 1ms has passed. */
+double
+ClockTicksPerNanosecond(void)
 {
-        LVAL_ERROR_DIV_ZERO,
-        LVAL_ERROR_BAD_OPERATOR,
-        LVAL_ERROR_BAD_NUMBER
-};
+        unsigned long long Nanoseconds, Ticks;
+        do
+        {
+                Nanoseconds = ClockNanoseconds();
+                Ticks = ClockTicks();
+        }
+        while(Nanoseconds - ClockBaseNanoseconds < 1000000);
 
-lval *
-LvalNumber(long Number)
-{
-        lval *Self = malloc(sizeof(lval));
-        Self->Type = LVAL_TYPE_NUMBER;
-        Self->Number = Number;
-        return(Self);
+        return((double)(Ticks - ClockBaseTicks) / (double)(Nanoseconds - ClockBaseNanoseconds));
 }
 
-lval *
-LvalError(char *Error)
+double
+ClockTicksToNanoseconds(unsigned long long Ticks)
 {
-        unsigned int StringLength = GSStringLength(Error);
-
-        lval *Self = malloc(sizeof(lval));
-        Self->Type = LVAL_TYPE_ERROR;
-        Self->Error = malloc(StringLength + 1);
-        GSStringCopy(Error, Self->Error, StringLength);
-        return(Self);
+        return(Ticks / ClockTicksPerNanosecond());
 }
 
-lval *
-LvalSymbol(char *Symbol)
+/******************************************************************************
+ * Hardware Counters
+ *-----------------------------------------------------------------------------
+ * --perf-counters opens a perf_event group on the main thread counting CPU
+ * time, cycles, instructions, cache misses and branch misses in user space,
+ * and charges their deltas to the phases of each top level evaluation:
+ * parse, read, eval, print and free. A single read(2) of the group leader at
+ * each phase boundary returns every counter at once.
+ *
+ * CPU time is a software event and leads the group. Hardware events that
+ * the machine, or a VM, doesn't provide are left out and reported as n/a. If
+ * the kernel multiplexes the group, counts are scaled up by the fraction of
+ * time it was running. The perf-counters builtin and exit print the totals.
+ ******************************************************************************/
+
+/* The phases of a top level evaluation, also timed by the latency histograms. */
+enum lphase_e
 {
-        unsigned int StringLength = GSStringLength(Symbol);
+        LPHASE_PARSE,
+        LPHASE_READ,
+        LPHASE_EVAL,
+        LPHASE_PRINT,
+        LPHASE_FREE,
+        LPHASE_COUNT
+};
+typedef enum lphase_e lphase;
 
-        lval *Self = malloc(sizeof(lval));
-        Self->Type = LVAL_TYPE_SYMBOL;
-        Self->Symbol = malloc(StringLength + 1);
-        GSStringCopy(Symbol, Self->Symbol, StringLength);
-        return(Self);
-}
+enum lcounter_event_e
+{
+        LCOUNTER_EVENT_TASK_CLOCK,
+        LCOUNTER_EVENT_CYCLES,
+        LCOUNTER_EVENT_INSTRUCTIONS,
+        LCOUNTER_EVENT_CACHE_MISSES,
+        LCOUNTER_EVENT_BRANCH_MISSES,
+        LCOUNTER_EVENT_COUNT
+};
 
-lval *
-LvalFunction(lbuiltin Function)
+static char *LphaseNames[LPHASE_COUNT] = { "parse", "read", "eval", "print", "free" };
+
+/* Deltas summed over every run of a phase. Values are indexed by event. */
+struct lcounter_total
 {
-        lval *Self = malloc(sizeof(lval));
-        Self->Type = LVAL_TYPE_FUNCTION;
-        Self->Function = Function;
-        return(Self);
-}
+        unsigned long long Count;
+        unsigned long long Enabled;
+        unsigned long long Running;
+        unsigned long long Values[LCOUNTER_EVENT_COUNT];
+};
+typedef struct lcounter_total lcounter_total;
 
-lval *
-LvalSExpression()
+static gs_bool LcounterEnabled = false;
+static int LcounterFds[LCOUNTER_EVENT_COUNT];
+
+/* Each event's position in a read of the group, or -1 if it isn't counted. */
+static int LcounterSlots[LCOUNTER_EVENT_COUNT];
+static unsigned int LcounterOpened = 0;
+
+static lcounter_total LcounterStart;
+static lcounter_total LcounterTotals[LPHASE_COUNT];
+
+#if defined(__linux__)
+int
+LcounterOpenEvent(unsigned int Type, unsigned long long Config, int Leader)
 {
-        lval *Self = malloc(sizeof(lval));
-        Self->Type = LVAL_TYPE_SEXPRESSION;
-        Self->CellCount = 0;
-        Self->Cell = GSNullPtr;
-        return(Self);
+        struct perf_event_attr Attributes = {0};
+        Attributes.size = sizeof(Attributes);
+        Attributes.type = Type;
+        Attributes.config = Config;
+        Attributes.exclude_kernel = 1;
+        Attributes.exclude_hv = 1;
+        Attributes.read_format = PERF_FORMAT_GROUP |
+                                 PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return(syscall(SYS_perf_event_open, &Attributes, 0, -1, Leader, 0));
 }
+#endif
 
-lval *
-LvalQExpression()
+/* Returns false, with errno set, if not even CPU time can be counted. */
+gs_bool
+LcounterOpen(void)
 {
-        lval *Self = malloc(sizeof(lval));
-        Self->Type = LVAL_TYPE_QEXPRESSION;
-        Self->CellCount = 0;
-        Self->Cell = GSNullPtr;
-        return(Self);
+#if defined(__linux__)
+        static const struct { unsigned int Type; unsigned long long Config; } Events[LCOUNTER_EVENT_COUNT] =
+        {
+                { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+                { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+                { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+                { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+                { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        };
+
+        for(int Event = 0; Event < LCOUNTER_EVENT_COUNT; Event++)
+        {
+                LcounterFds[Event] = LcounterOpenEvent(Events[Event].Type, Events[Event].Config,
+                                                       Event == 0 ? -1 : LcounterFds[0]);
+                LcounterSlots[Event] = (LcounterFds[Event] < 0) ? -1 : (int)LcounterOpened++;
+                if(Event == 0 && LcounterFds[Event] < 0) return(false);
+        }
+
+        LcounterEnabled = true;
+        return(true);
+#else
+        errno = ENOSYS;
+        return(false);
+#endif
 }
 
 void
-LvalFree(lval *Self)
+LcounterClose(void)
 {
-        switch(Self->Type)
+        if(!LcounterEnabled) return;
+        for(int Event = 0; Event < LCOUNTER_EVENT_COUNT; Event++)
         {
-                case LVAL_TYPE_FUNCTION:                            break;
-                case LVAL_TYPE_NUMBER:                              break;
-                case LVAL_TYPE_ERROR:       { free(Self->Error);  } break;
-                case LVAL_TYPE_SYMBOL:      { free(Self->Symbol); } break;
-                case LVAL_TYPE_QEXPRESSION:
-                case LVAL_TYPE_SEXPRESSION:
-                {
-                        for(int I = 0; I < Self->CellCount; I++)
-                        {
-                                LvalFree(Self->Cell[I]);
-                        }
-                        free(Self->Cell);
-                } break;
+                if(LcounterFds[Event] >= 0) close(LcounterFds[Event]);
         }
-        free(Self);
+        LcounterEnabled = false;
 }
 
-lval *
-LvalCopy(lval *Self)
+/* Reads the whole group: count, time enabled, time running, then one value per event opened. */
+void
+LcounterRead(lcounter_total *Sample)
 {
-        lval *Result = malloc(sizeof(lval));
-        Result->Type = Self->Type;
+        unsigned long long Buffer[3 + LCOUNTER_EVENT_COUNT] = {0};
+        if(read(LcounterFds[0], Buffer, sizeof(Buffer)) <= 0) return;
 
-        switch(Self->Type)
+        Sample->Enabled = Buffer[1];
+        Sample->Running = Buffer[2];
+        for(int Event = 0; Event < LCOUNTER_EVENT_COUNT; Event++)
         {
-                case(LVAL_TYPE_FUNCTION):
-                {
-                        Result->Function = Self->Function;
-                        break;
-                }
-                case(LVAL_TYPE_NUMBER):
-                {
-                        Result->Number = Self->Number;
-                        break;
-                }
-                case(LVAL_TYPE_ERROR):
-                {
-                        unsigned int StringLength = GSStringLength(Self->Error);
-                        Result->Error = malloc(StringLength + 1);
-                        GSStringCopy(Self->Error, Result->Error, StringLength);
-                        break;
-                }
-                case(LVAL_TYPE_SYMBOL):
-                {
-                        unsigned int StringLength = GSStringLength(Self->Symbol);
-                        Result->Symbol = malloc(StringLength + 1);
-                        GSStringCopy(Self->Symbol, Result->Symbol, StringLength);
-                        break;
-                }
-                case(LVAL_TYPE_SEXPRESSION):
-                case(LVAL_TYPE_QEXPRESSION):
-                {
-                        Result->CellCount = Self->CellCount;
-                        Result->Cell = malloc(sizeof(lval *) * Self->CellCount);
-                        for(int Index = 0; Index < Self->CellCount; Index++)
-                        {
-                                Result->Cell[Index] = LvalCopy(Self->Cell[Index]);
-                        }
-                        break;
-                }
+                if(LcounterSlots[Event] >= 0) Sample->Values[Event] = Buffer[3 + LcounterSlots[Event]];
         }
+}
 
-        return(Result);
+void
+LcounterBegin(void)
+{
+        if(LcounterEnabled) LcounterRead(&LcounterStart);
 }
 
-lval *
-LvalReadNumber(mpc_ast_t *Tree)
+void
+LcounterEnd(lphase Phase)
 {
-        lval *Result;
+        if(!LcounterEnabled) return;
 
-        errno = 0;
-        long Number = strtol(Tree->contents, NULL, 10);
-        if(errno == ERANGE)
-        {
-                Result = LvalError("Invalid Number");
-        }
-        else
+        lcounter_total Now = LcounterStart;
+        LcounterRead(&Now);
+
+        lcounter_total *Total = &LcounterTotals[Phase];
+        Total->Count++;
+        Total->Enabled += Now.Enabled - LcounterStart.Enabled;
+        Total->Running += Now.Running - LcounterStart.Running;
+        for(int Event = 0; Event < LCOUNTER_EVENT_COUNT; Event++)
         {
-                Result = LvalNumber(Number);
+                Total->Values[Event] += Now.Values[Event] - LcounterStart.Values[Event];
         }
-        return(Result);
 }
 
-lval *
-LvalAdd(lval *Self, lval *ToAdd)
+/* Returns Event's total scaled for multiplexing, or -1 if it isn't counted. */
+double
+LcounterValue(lcounter_total *Total, int Event)
 {
-        Self->CellCount++;
-        Self->Cell = realloc(Self->Cell, sizeof(lval *) * Self->CellCount);
-        Self->Cell[Self->CellCount-1] = ToAdd;
-        return(Self);
+        if(LcounterSlots[Event] < 0) return(-1);
+        if(Total->Running == 0 || Total->Running >= Total->Enabled) return((double)Total->Values[Event]);
+        return((double)Total->Values[Event] * Total->Enabled / Total->Running);
 }
 
-lval *
-LvalRead(mpc_ast_t *Tree)
+void
+LcounterPrintValue(FILE *File, int Width, double Value)
 {
-        lval *Result = GSNullPtr;
-
-        if(GSStringHasSubstring(Tree->tag, 0, "number", 6)) return(LvalReadNumber(Tree));
-        if(GSStringHasSubstring(Tree->tag, 0, "symbol", 6)) return(LvalSymbol(Tree->contents));
-
-        if(GSStringIsEqual(Tree->tag, ">", 1))             Result = LvalSExpression();
-        if(GSStringHasSubstring(Tree->tag, 0, "sexpr", 5)) Result = LvalSExpression();
-        if(GSStringHasSubstring(Tree->tag, 0, "qexpr", 5)) Result = LvalQExpression();
+        if(Value < 0) fprintf(File, " %*s", Width, "n/a");
+        else fprintf(File, " %*.0f", Width, Value);
+}
 
-        for(int I=0; I<Tree->children_num; I++)
-        {
-                if(GSStringIsEqual(Tree->children[I]->contents, "(", 1)) continue;
-                if(GSStringIsEqual(Tree->children[I]->contents, ")", 1)) continue;
-                if(GSStringIsEqual(Tree->children[I]->contents, "}", 1)) continue;
-                if(GSStringIsEqual(Tree->children[I]->contents, "{", 1)) continue;
-                if(GSStringIsEqual(Tree->children[I]->tag, "regex", 5))  continue;
-                Result = LvalAdd(Result, LvalRead(Tree->children[I]));
-        }
+void
+LcounterPrintRow(FILE *File, char *Name, lcounter_total *Total)
+{
+        double Cycles = LcounterValue(Total, LCOUNTER_EVENT_CYCLES);
+        double Instructions = LcounterValue(Total, LCOUNTER_EVENT_INSTRUCTIONS);
 
-        return(Result);
+        fprintf(File, "%-8s %10llu %12.3f", Name, Total->Count,
+                LcounterValue(Total, LCOUNTER_EVENT_TASK_CLOCK) / 1e6);
+        LcounterPrintValue(File, 16, Cycles);
+        LcounterPrintValue(File, 16, Instructions);
+        if(Cycles > 0 && Instructions >= 0) fprintf(File, " %6.2f", Instructions / Cycles);
+        else fprintf(File, " %6s", "n/a");
+        LcounterPrintValue(File, 14, LcounterValue(Total, LCOUNTER_EVENT_CACHE_MISSES));
+        LcounterPrintValue(File, 14, LcounterValue(Total, LCOUNTER_EVENT_BRANCH_MISSES));
+        fputc('\n', File);
 }
 
-void LvalPrint(lval *Value);
-
 void
-LvalPrintExpression(lval *Self, char Open, char Close)
+LcounterPrint(FILE *File)
 {
-        putchar(Open);
+        fprintf(File, "%-8s %10s %12s %16s %16s %6s %14s %14s\n", "phase", "count", "cpu ms",
+                "cycles", "instructions", "IPC", "cache misses", "branch misses");
 
-        for(int I=0; I < Self->CellCount; I++)
+        /* Scaling is per phase, so the total sums scaled values rather than raw ones. */
+        lcounter_total Total = {0};
+        for(int Phase = 0; Phase < LPHASE_COUNT; Phase++)
         {
-                LvalPrint(Self->Cell[I]);
+                lcounter_total *Row = &LcounterTotals[Phase];
+                LcounterPrintRow(File, LphaseNames[Phase], Row);
 
-                if(I != (Self->CellCount - 1))
+                Total.Count += Row->Count;
+                for(int Event = 0; Event < LCOUNTER_EVENT_COUNT; Event++)
                 {
-                        putchar(' ');
+                        double Value = LcounterValue(Row, Event);
+                        if(Value > 0) Total.Values[Event] += (unsigned long long)Value;
                 }
         }
-
-        putchar(Close);
+        LcounterPrintRow(File, "total", &Total);
 }
 
-void
-LvalPrint(lval *Self)
-{
-        switch(Self->Type)
-        {
-                case(LVAL_TYPE_FUNCTION):    printf("<function>");                break;
-                case(LVAL_TYPE_NUMBER):      printf("%li", Self->Number);         break;
-                case(LVAL_TYPE_ERROR):       printf("Error: %s", Self->Error);    break;
-                case(LVAL_TYPE_SYMBOL):      printf("%s", Self->Symbol);          break;
-                case(LVAL_TYPE_SEXPRESSION): LvalPrintExpression(Self, '(', ')'); break;
-                case(LVAL_TYPE_QEXPRESSION): LvalPrintExpression(Self, '{', '}'); break;
-        }
-}
+/******************************************************************************
+ * Latency Histograms
+ *-----------------------------------------------------------------------------
+ * --latency records how long each phase of each top level evaluation takes,
+ * plus the whole expression end to end, in log-bucketed histograms like
+ * HdrHistogram's. Each power of two is split into 32 linear buckets, so a
+ * reported value is within about 3% of the true one at any magnitude, and a
+ * recording is a bit scan and an increment. Values are in clock ticks and
+ * converted when printed. The latency builtin and exit print p50, p90, p99,
+ * p99.9 and max. A script is parsed and read once as a whole, so there an
+ * expression's end to end time covers its eval, print and free.
+ *
+ * Histograms merge by adding their buckets, so threads can record into their
+ * own and be summed afterwards; --bench-lookups reports lookup latency that
+ * way.
+ ******************************************************************************/
 
-void
-LvalPrintLine(lval *Self)
-{
-        LvalPrint(Self);
-        putchar('\n');
-}
+#define LHISTOGRAM_SUB_BITS 5
+#define LHISTOGRAM_SUB_COUNT (1 << LHISTOGRAM_SUB_BITS)
+#define LHISTOGRAM_BUCKETS ((64 - LHISTOGRAM_SUB_BITS + 1) * LHISTOGRAM_SUB_COUNT)
 
-lval *
-LvalPop(lval *Self, unsigned int Index)
+struct lhistogram
 {
-        lval *Result = Self->Cell[Index];
+        unsigned long long Count;
+        unsigned long long Max;
+        unsigned long long Buckets[LHISTOGRAM_BUCKETS];
+};
+typedef struct lhistogram lhistogram;
 
-        GSMemoryCopy(&(Self->Cell[Index + 1]), &(Self->Cell[Index]),
-                     sizeof(lval *) * (Self->CellCount - Index - 1));
+static gs_bool LhistogramEnabled = false;
+static lhistogram LhistogramPhases[LPHASE_COUNT];
+static lhistogram LhistogramExpression;
 
-        Self->CellCount--;
+/*
+ * Values below 2 * LHISTOGRAM_SUB_COUNT get a bucket each. Above that, a
+ * value whose top bit is bit Shift + LHISTOGRAM_SUB_BITS goes by its top
+ * LHISTOGRAM_SUB_BITS + 1 bits.
+ */
+unsigned int
+LhistogramIndex(unsigned long long Value)
+{
+        if(Value < 2 * LHISTOGRAM_SUB_COUNT) return((unsigned int)Value);
 
-        Self->Cell = realloc(Self->Cell, sizeof(lval *) * Self->CellCount);
-        return(Result);
+        unsigned int Shift = 63 - __builtin_clzll(Value) - LHISTOGRAM_SUB_BITS;
+        return(Shift * LHISTOGRAM_SUB_COUNT + (unsigned int)(Value >> Shift));
 }
 
-lval *
-LvalTake(lval *Self, unsigned int Index)
+/* The largest value that lands in Index. */
+unsigned long long
+LhistogramHighest(unsigned int Index)
 {
-        lval *Result = LvalPop(Self, Index);
-        LvalFree(Self);
-        return(Result);
-}
-
-/******************************************************************************
- * lenv Type and Functions
- ******************************************************************************/
+        if(Index < 2 * LHISTOGRAM_SUB_COUNT) return(Index);
 
-struct lenv
-{
-        unsigned int Count;
-        char **Symbols;
-        lval **Values;
-};
+        unsigned int Shift = Index / LHISTOGRAM_SUB_COUNT - 1;
+        unsigned long long Bits = Index - Shift * LHISTOGRAM_SUB_COUNT;
+        return(((Bits + 1) << Shift) - 1);
+}
 
-lenv *
-LenvNew(void)
+void
+LhistogramRecord(lhistogram *Self, unsigned long long Value)
 {
-        lenv *Result = malloc(sizeof(lenv));
-        Result->Count = 0;
-        Result->Symbols = GSNullPtr;
-        Result->Values = GSNullPtr;
-        return(Result);
+        Self->Buckets[LhistogramIndex(Value)]++;
+        Self->Count++;
+        if(Value > Self->Max) Self->Max = Value;
 }
 
 void
-LenvFree(lenv *Self)
+LhistogramMerge(lhistogram *Self, lhistogram *Other)
 {
-        for(int Index = 0; Index < Self->Count; Index++)
+        for(unsigned int Index = 0; Index < LHISTOGRAM_BUCKETS; Index++)
         {
-                free(Self->Symbols[Index]);
-                LvalFree(Self->Values[Index]);
+                Self->Buckets[Index] += Other->Buckets[Index];
         }
-        free(Self->Symbols);
-        free(Self->Values);
-        free(Self);
+        Self->Count += Other->Count;
+        if(Other->Max > Self->Max) Self->Max = Other->Max;
 }
 
-lval *
-LenvGet(lenv *Self, lval *Key)
+/* The value Percentile percent of recordings are at or below, or 0 if there are none. */
+unsigned long long
+LhistogramPercentile(lhistogram *Self, double Percentile)
 {
-        lval *Result = GSNullPtr;
+        if(Self->Count == 0) return(0);
 
-        for(int Index = 0; Index < Self->Count; Index++)
+        unsigned long long Rank = (unsigned long long)(Percentile / 100.0 * Self->Count + 0.999999);
+        Rank = GSMax(Rank, 1);
+
+        unsigned long long Seen = 0;
+        for(unsigned int Index = 0; Index < LHISTOGRAM_BUCKETS; Index++)
         {
-                char *Symbol = Self->Symbols[Index];
-                unsigned int StringLength = GSStringLength(Symbol);
-                if(GSStringIsEqual(Symbol, Key->Symbol, StringLength))
-                {
-                        Result = LvalCopy(Self->Values[Index]);
-                        return(Result);
-                }
+                Seen += Self->Buckets[Index];
+                if(Seen >= Rank) return(GSMin(LhistogramHighest(Index), Self->Max));
         }
+        return(Self->Max);
+}
 
-        Result = LvalError("Unbound Symbol!");
-        return(Result);
+void
+LhistogramPrintRow(FILE *File, char *Name, lhistogram *Self, double TicksPerNanosecond)
+{
+        fprintf(File, "%-10s %10llu %10.0f %10.0f %10.0f %10.0f %10.0f\n", Name, Self->Count,
+                LhistogramPercentile(Self, 50.0) / TicksPerNanosecond,
+                LhistogramPercentile(Self, 90.0) / TicksPerNanosecond,
+                LhistogramPercentile(Self, 99.0) / TicksPerNanosecond,
+                LhistogramPercentile(Self, 99.9) / TicksPerNanosecond,
+                Self->Max / TicksPerNanosecond);
 }
 
 void
-LenvPut(lenv *Self, lval *Key, lval *Value)
+LhistogramPrint(FILE *File)
 {
-        for(int Index = 0; Index < Self->Count; Index++)
+        double TicksPerNanosecond = ClockTicksPerNanosecond();
+        fprintf(File, "%-10s %10s %10s %10s %10s %10s %10s\n",
+                "latency ns", "count", "p50", "p90", "p99", "p99.9", "max");
+        for(int Phase = 0; Phase < LPHASE_COUNT; Phase++)
         {
-                char *Symbol = Self->Symbols[Index];
-                unsigned int StringLength = GSStringLength(Symbol);
-                if(GSStringIsEqual(Symbol, Key->Symbol, StringLength))
-                {
-                        LvalFree(Self->Values[Index]);
-                        Self->Values[Index] = LvalCopy(Key);
-                        return;
-                }
+                LhistogramPrintRow(File, LphaseNames[Phase], &LhistogramPhases[Phase], TicksPerNanosecond);
         }
+        LhistogramPrintRow(File, "expression", &LhistogramExpression, TicksPerNanosecond);
+}
 
-        Self->Count++;
-        Self->Values = realloc(Self->Values, sizeof(lval *) * Self->Count);
-        Self->Symbols = realloc(Self->Symbols, sizeof(char *) * Self->Count);
-
-        Self->Values[Self->Count-1] = LvalCopy(Value);
-        unsigned int StringLength = GSStringLength(Key->Symbol);
-        Self->Symbols[Self->Count-1] = malloc(StringLength + 1);
-        GSStringCopy(Key->Symbol, Self->Symbols[Self->Count-1], StringLength);
+/* The same percentiles as a JSON object, in nanoseconds. */
+void
+LhistogramPrintJson(FILE *File, lhistogram *Self, double TicksPerNanosecond)
+{
+        fprintf(File, "{\"count\": %llu, \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"p99.9\": %.0f, \"max\": %.0f}",
+                Self->Count,
+                LhistogramPercentile(Self, 50.0) / TicksPerNanosecond,
+                LhistogramPercentile(Self, 90.0) / TicksPerNanosecond,
+                LhistogramPercentile(Self, 99.0) / TicksPerNanosecond,
+                LhistogramPercentile(Self, 99.9) / TicksPerNanosecond,
+                Self->Max / TicksPerNanosecond);
 }
 
+/*
+ * Phase boundaries feed both the perf counters and the histograms. The clock
+ * is read inside the counter reads, so their cost isn't in the latencies.
+ */
+static unsigned long long LphaseStart = 0;
+static unsigned long long LphaseExpressionStart = 0;
+
 void
-LenvAddBuiltIn(lenv *Env, char *Name, lbuiltin Function)
+LphaseBegin(void)
 {
-        lval *Key = LvalSymbol(Name);
-        lval *Value = LvalFunction(Function);
-        LenvPut(Env, Key, Value);
-        LvalFree(Key);
-        LvalFree(Value);
+        LcounterBegin();
+        if(LhistogramEnabled) LphaseStart = ClockTicks();
 }
 
-lval *BuiltInList(lenv *Env, lval *Value);
-lval *BuiltInHead(lenv *Env, lval *Value);
-lval *BuiltInTail(lenv *Env, lval *Value);
-lval *BuiltInEval(lenv *Env, lval *Value);
-lval *BuiltInJoin(lenv *Env, lval *Value);
-lval *BuiltInAdd(lenv *Env, lval *Value);
-lval *BuiltInSubtract(lenv *Env, lval *Value);
-lval *BuiltInMultiply(lenv *Env, lval *Value);
-lval *BuiltInDivide(lenv *Env, lval *Value);
+void
+LphaseEnd(lphase Phase)
+{
+        if(LhistogramEnabled) LhistogramRecord(&LhistogramPhases[Phase], ClockTicks() - LphaseStart);
+        LcounterEnd(Phase);
+}
 
 void
-LenvAddBuiltIns(lenv *Env)
+LphaseExpressionBegin(void)
 {
-        /* List Functions */
-        LenvAddBuiltIn(Env, "list", BuiltInList);
-        LenvAddBuiltIn(Env, "head", BuiltInHead);
-        LenvAddBuiltIn(Env, "tail", BuiltInTail);
-        LenvAddBuiltIn(Env, "eval", BuiltInEval);
-        LenvAddBuiltIn(Env, "join", BuiltInJoin);
+        if(LhistogramEnabled) LphaseExpressionStart = ClockTicks();
+}
 
-        /* Math Functions */
-        LenvAddBuiltIn(Env, "+", BuiltInAdd);
-        LenvAddBuiltIn(Env, "-", BuiltInSubtract);
-        LenvAddBuiltIn(Env, "*", BuiltInMultiply);
-        LenvAddBuiltIn(Env, "/", BuiltInDivide);
+void
+LphaseExpressionEnd(void)
+{
+        if(LhistogramEnabled) LhistogramRecord(&LhistogramExpression, ClockTicks() - LphaseExpressionStart);
 }
 
 /******************************************************************************
+ * Resource Governor
+ *-----------------------------------------------------------------------------
+ * Limits on a single top level evaluation, set with --fuel and --max-bytes.
+ * Every LispEval call is one reduction and costs one unit of fuel. Every
+ * LallocMalloc and LallocRealloc charges the bytes it asks for, freed or not,
+ * so the ceiling bounds how much allocation work an evaluation may do. Once
+ * either limit is hit, LispEval returns an error for everything still pending,
+ * which unwinds the evaluation without further work.
  ******************************************************************************/
 
-lval *
-BuiltInOperator(lenv *Env, lval *Self, char *Operator)
-{
-        lval *Result = GSNullPtr;
+static unsigned long long LgovernorFuelLimit = 0;
+static unsigned long long LgovernorByteLimit = 0;
 
-        for(int Cell = 0; Cell < Self->CellCount; Cell++)
-        {
-                if(Self->Cell[Cell]->Type != LVAL_TYPE_NUMBER)
-                {
-                        LvalFree(Self);
-                        Result = LvalError("Cannot operate on non-number");
-                        return(Result);
-                }
-        }
+/*
+ * Unlimited is the largest value, so the hot path needs no extra test. Worker
+ * threads allocate too, so each thread keeps its own count.
+ */
+static __thread unsigned long long LgovernorFuel = ~0ULL;
+static __thread unsigned long long LgovernorBytes = 0;
+static __thread unsigned long long LgovernorByteCeiling = ~0ULL;
 
-        Result = LvalPop(Self, 0);
+#define LgovernorCharge(Size) (LgovernorBytes += (Size))
+#define LgovernorIsExhausted() (LgovernorFuel == 0 || LgovernorBytes > LgovernorByteCeiling)
 
-        if(GSStringIsEqual(Operator, "-", 1) && Self->CellCount == 0)
-        {
-                Result->Number = -(Result->Number);
-        }
+/* Called before each top level evaluation. */
+void
+LgovernorReset(void)
+{
+        LgovernorFuel = LgovernorFuelLimit ? LgovernorFuelLimit : ~0ULL;
+        LgovernorBytes = 0;
+        LgovernorByteCeiling = LgovernorByteLimit ? LgovernorByteLimit : ~0ULL;
+}
+
+/******************************************************************************
+ * Allocation Tracking
+ *-----------------------------------------------------------------------------
+ * Build with -DLISPY_ALLOC_STATS -DMPC_ALLOC_HOOKS to count allocations per
+ * subsystem. Each block gets a small header recording its size and tag, so
+ * frees are charged back to the subsystem that made the allocation. Without
+ * the flag the Lalloc macros are plain malloc, realloc and free.
+ ******************************************************************************/
+
+enum lalloc_tag_e
+{
+        LALLOC_TAG_READER,
+        LALLOC_TAG_EVALUATOR,
+        LALLOC_TAG_ENV,
+        LALLOC_TAG_ERRORS,
+        LALLOC_TAG_MPC_INPUT,
+        LALLOC_TAG_AST,
+        LALLOC_TAG_PARSER,
+        LALLOC_TAG_MEMO,
+        LALLOC_TAG_COUNT
+};
+typedef enum lalloc_tag_e lalloc_tag;
+
+#ifdef LISPY_ALLOC_STATS
+
+static char *LallocTagNames[LALLOC_TAG_COUNT] = { "reader", "evaluator", "env", "errors", "mpc input", "ast", "parser", "memo" };
+
+struct lalloc_stats
+{
+        unsigned long long Allocations;
+        unsigned long long Frees;
+        unsigned long long Bytes;
+        unsigned long long Live;
+        unsigned long long HighWater;
+};
+typedef struct lalloc_stats lalloc_stats;
+
+/* Two words, so blocks keep malloc's 16 byte alignment. */
+struct lalloc_header
+{
+        size_t Size;
+        size_t Tag;
+};
+typedef struct lalloc_header lalloc_header;
+
+static lalloc_stats LallocStats[LALLOC_TAG_COUNT];
+static lalloc_stats LallocTotal;
+
+/* Allocations made through the lval constructors are charged to this. */
+static __thread lalloc_tag LallocTag = LALLOC_TAG_EVALUATOR;
+
+/* Worker threads allocate and free too, so every counter is updated atomically. */
+void
+LallocChargeAllocation(lalloc_tag Tag, size_t Size)
+{
+        lalloc_stats *Stats[] = { &LallocStats[Tag], &LallocTotal };
+        for(int Index = 0; Index < 2; Index++)
+        {
+                __atomic_add_fetch(&Stats[Index]->Allocations, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&Stats[Index]->Bytes, Size, __ATOMIC_RELAXED);
+                unsigned long long Live = __atomic_add_fetch(&Stats[Index]->Live, Size, __ATOMIC_RELAXED);
+                unsigned long long HighWater = __atomic_load_n(&Stats[Index]->HighWater, __ATOMIC_RELAXED);
+                while(Live > HighWater &&
+                      !__atomic_compare_exchange_n(&Stats[Index]->HighWater, &HighWater, Live, true,
+                                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        }
+}
+
+void
+LallocChargeFree(lalloc_tag Tag, size_t Size)
+{
+        __atomic_add_fetch(&LallocStats[Tag].Frees, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&LallocStats[Tag].Live, Size, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&LallocTotal.Frees, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&LallocTotal.Live, Size, __ATOMIC_RELAXED);
+}
+
+void *
+LallocTrackedMalloc(lalloc_tag Tag, size_t Size)
+{
+        lalloc_header *Header = malloc(sizeof(lalloc_header) + Size);
+        if(Header == GSNullPtr) return(GSNullPtr);
+
+        Header->Size = Size;
+        Header->Tag = Tag;
+        LallocChargeAllocation(Tag, Size);
+        return(Header + 1);
+}
+
+/*
+ * Counted as freeing the old block and allocating the new one. A resized block
+ * stays charged to the subsystem that first allocated it.
+ */
+void *
+LallocTrackedRealloc(lalloc_tag Tag, void *Pointer, size_t Size)
+{
+        if(Pointer == GSNullPtr) return(LallocTrackedMalloc(Tag, Size));
+
+        lalloc_header *Header = (lalloc_header *)Pointer - 1;
+        size_t OldSize = Header->Size;
+        Header = realloc(Header, sizeof(lalloc_header) + Size);
+        if(Header == GSNullPtr) return(GSNullPtr);
+
+        Header->Size = Size;
+        LallocChargeFree(Header->Tag, OldSize);
+        LallocChargeAllocation(Header->Tag, Size);
+        return(Header + 1);
+}
+
+void
+LallocTrackedFree(void *Pointer)
+{
+        if(Pointer == GSNullPtr) return;
+
+        lalloc_header *Header = (lalloc_header *)Pointer - 1;
+        LallocChargeFree(Header->Tag, Header->Size);
+        free(Header);
+}
+
+/* mpc's own tags, from mpc.h, mapped onto ours. */
+static lalloc_tag LallocMpcTags[] =
+{
+        [MPC_ALLOC_PARSER] = LALLOC_TAG_PARSER,
+        [MPC_ALLOC_INPUT]  = LALLOC_TAG_MPC_INPUT,
+        [MPC_ALLOC_ERROR]  = LALLOC_TAG_ERRORS,
+        [MPC_ALLOC_AST]    = LALLOC_TAG_AST,
+};
+
+void *mpc_hook_malloc(int Tag, size_t Size) { return(LallocTrackedMalloc(LallocMpcTags[Tag], Size)); }
+void *mpc_hook_realloc(int Tag, void *Pointer, size_t Size) { return(LallocTrackedRealloc(LallocMpcTags[Tag], Pointer, Size)); }
+void mpc_hook_free(void *Pointer) { LallocTrackedFree(Pointer); }
+
+void *
+mpc_hook_calloc(int Tag, size_t Count, size_t Size)
+{
+        void *Result = LallocTrackedMalloc(LallocMpcTags[Tag], Count * Size);
+        if(Result != GSNullPtr) memset(Result, 0, Count * Size);
+        return(Result);
+}
+
+void
+LallocPrint(FILE *File)
+{
+        fprintf(File, "%-12s %12s %12s %14s %12s %12s\n", "subsystem", "allocs", "frees", "bytes", "live", "high water");
+        for(int Tag = 0; Tag <= LALLOC_TAG_COUNT; Tag++)
+        {
+                lalloc_stats *Stats = (Tag == LALLOC_TAG_COUNT) ? &LallocTotal : &LallocStats[Tag];
+                char *Name = (Tag == LALLOC_TAG_COUNT) ? "total" : LallocTagNames[Tag];
+                fprintf(File, "%-12s %12llu %12llu %14llu %12llu %12llu\n",
+                        Name, Stats->Allocations, Stats->Frees, Stats->Bytes, Stats->Live, Stats->HighWater);
+        }
+}
+
+#define LallocMalloc(Tag, Size) (LgovernorCharge(Size), LallocTrackedMalloc((Tag), (Size)))
+#define LallocRealloc(Tag, Pointer, Size) (LgovernorCharge(Size), LallocTrackedRealloc((Tag), (Pointer), (Size)))
+#define LallocFree(Pointer) LallocTrackedFree(Pointer)
+#define LallocSetTag(Tag) (LallocTag = (Tag))
+#define LallocTagPush(Tag) lalloc_tag LallocSavedTag = LallocTag; LallocTag = (Tag)
+#define LallocTagPop() (LallocTag = LallocSavedTag)
+
+#else
+
+#define LallocMalloc(Tag, Size) (LgovernorCharge(Size), malloc(Size))
+#define LallocRealloc(Tag, Pointer, Size) (LgovernorCharge(Size), realloc((Pointer), (Size)))
+#define LallocFree(Pointer) free(Pointer)
+#define LallocSetTag(Tag)
+#define LallocTagPush(Tag)
+#define LallocTagPop()
+
+#endif /* LISPY_ALLOC_STATS */
+
+/******************************************************************************
+ * lbuffer Type and Functions
+ *-----------------------------------------------------------------------------
+ * Growable output buffer. Memory is kept between uses, so once it has grown to
+ * fit the largest output, rendering into it no longer allocates.
+ ******************************************************************************/
+
+struct lbuffer
+{
+        char *Start;
+        size_t Length;
+        size_t Capacity;
+};
+typedef struct lbuffer lbuffer;
+
+void
+LbufferReserve(lbuffer *Self, size_t Wanted)
+{
+        if(Self->Length + Wanted <= Self->Capacity) return;
+
+        size_t Capacity = GSMax(Self->Capacity * 2, 4096);
+        while(Capacity < Self->Length + Wanted) Capacity *= 2;
+
+        Self->Start = realloc(Self->Start, Capacity);
+        Self->Capacity = Capacity;
+}
+
+void
+LbufferPutChar(lbuffer *Self, char C)
+{
+        LbufferReserve(Self, 1);
+        Self->Start[Self->Length++] = C;
+}
+
+void
+LbufferPutBytes(lbuffer *Self, char *Bytes, size_t Count)
+{
+        LbufferReserve(Self, Count);
+        memcpy(Self->Start + Self->Length, Bytes, Count);
+        Self->Length += Count;
+}
+
+void
+LbufferPutString(lbuffer *Self, char *String)
+{
+        LbufferPutBytes(Self, String, GSStringLength(String));
+}
+
+/* Puts String escaped for use inside a JSON string; builtin names such as \ need it. */
+void
+LbufferPutJsonString(lbuffer *Self, char *String)
+{
+        for(unsigned char *C = (unsigned char *)String; *C != '\0'; C++)
+        {
+                if(*C == '"' || *C == '\\')
+                {
+                        LbufferPutChar(Self, '\\');
+                        LbufferPutChar(Self, *C);
+                }
+                else if(*C < 0x20)
+                {
+                        LbufferPutString(Self, "\\u00");
+                        LbufferPutChar(Self, "0123456789abcdef"[*C >> 4]);
+                        LbufferPutChar(Self, "0123456789abcdef"[*C & 0xf]);
+                }
+                else
+                {
+                        LbufferPutChar(Self, *C);
+                }
+        }
+}
+
+static const char LbufferDigitPairs[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+/* Same output as printf("%li"), written two digits at a time from the end. */
+void
+LbufferPutNumber(lbuffer *Self, long Number)
+{
+        char Scratch[24];
+        char *End = Scratch + sizeof(Scratch);
+        char *Cursor = End;
+
+        /* Negate as unsigned so LONG_MIN doesn't overflow. */
+        unsigned long Magnitude = (Number < 0) ? 0UL - (unsigned long)Number : (unsigned long)Number;
+
+        while(Magnitude >= 100)
+        {
+                unsigned int Pair = (unsigned int)(Magnitude % 100) * 2;
+                Magnitude /= 100;
+                Cursor -= 2;
+                Cursor[0] = LbufferDigitPairs[Pair];
+                Cursor[1] = LbufferDigitPairs[Pair + 1];
+        }
+
+        if(Magnitude >= 10)
+        {
+                unsigned int Pair = (unsigned int)Magnitude * 2;
+                Cursor -= 2;
+                Cursor[0] = LbufferDigitPairs[Pair];
+                Cursor[1] = LbufferDigitPairs[Pair + 1];
+        }
+        else
+        {
+                *--Cursor = (char)('0' + Magnitude);
+        }
+
+        if(Number < 0) *--Cursor = '-';
+
+        LbufferPutBytes(Self, Cursor, End - Cursor);
+}
+
+/* LEB128: seven bits per byte, low bits first, high bit set on all but the last. */
+void
+LbufferPutVarint(lbuffer *Self, unsigned long long Value)
+{
+        LbufferReserve(Self, 10);
+        while(Value >= 0x80)
+        {
+                Self->Start[Self->Length++] = (char)(Value | 0x80);
+                Value >>= 7;
+        }
+        Self->Start[Self->Length++] = (char)Value;
+}
+
+void
+LbufferFlush(lbuffer *Self, FILE *File)
+{
+        fwrite(Self->Start, 1, Self->Length, File);
+        Self->Length = 0;
+}
+
+/* Uses only write(2), so it is safe in a signal handler. */
+gs_bool
+LbufferFlushFd(lbuffer *Self, int Fd)
+{
+        size_t Written = 0;
+        while(Written < Self->Length)
+        {
+                ssize_t Count = write(Fd, Self->Start + Written, Self->Length - Written);
+                if(Count <= 0) break;
+                Written += Count;
+        }
+        gs_bool Result = (Written == Self->Length);
+        Self->Length = 0;
+        return(Result);
+}
+
+/******************************************************************************
+ * Tracing
+ *-----------------------------------------------------------------------------
+ * Enter and exit events go into a fixed size ring buffer owned by the calling
+ * thread, overwriting the oldest events once it wraps. While tracing is off
+ * each trace point is one well predicted branch on LtraceEnabled.
+ *
+ * LtraceWrite formats the ring as Chrome trace JSON (chrome://tracing or
+ * ui.perfetto.dev) using only write(2), so it may run in a signal handler.
+ ******************************************************************************/
+
+#define LTRACE_CAPACITY (1 << 16)
+
+struct ltrace_event
+{
+        unsigned long long Ticks;
+        char *Name;
+        unsigned int Depth;
+        unsigned int Cells;
+        char Phase;
+};
+typedef struct ltrace_event ltrace_event;
+
+static volatile sig_atomic_t LtraceEnabled = false;
+static char *LtraceFile = GSNullPtr;
+
+static __thread ltrace_event *LtraceRing = GSNullPtr;
+static __thread unsigned long long LtraceHead = 0;
+static __thread unsigned int LtraceDepth = 0;
+
+#define LtraceEnter(Name, Cells) if(__builtin_expect(LtraceEnabled, false)) LtraceRecord('B', (Name), (Cells))
+#define LtraceExit(Name) if(__builtin_expect(LtraceEnabled, false)) LtraceRecord('E', (Name), 0)
+
+__attribute__((noinline)) void
+LtraceRecord(char Phase, char *Name, unsigned int Cells)
+{
+        if(LtraceRing == GSNullPtr)
+        {
+                LtraceRing = malloc(sizeof(ltrace_event) * LTRACE_CAPACITY);
+                if(LtraceRing == GSNullPtr) return;
+        }
+
+        if(Phase == 'E' && LtraceDepth > 0) LtraceDepth--;
+
+        ltrace_event *Event = &LtraceRing[LtraceHead++ & (LTRACE_CAPACITY - 1)];
+        Event->Ticks = ClockTicks();
+        Event->Name = Name;
+        Event->Depth = LtraceDepth;
+        Event->Cells = Cells;
+        Event->Phase = Phase;
+
+        if(Phase == 'B') LtraceDepth++;
+}
+
+/*
+ * Writes the calling thread's ring as JSON. Timestamps are microseconds since
+ * ClockInit. The buffer lives on the stack and is flushed before it can fill,
+ * so LbufferReserve never reallocates it.
+ */
+void
+LtraceWrite(int Fd)
+{
+        char Scratch[16384];
+        lbuffer Buffer = { Scratch, 0, sizeof(Scratch) };
+
+        double TicksPerNanosecond = ClockTicksPerNanosecond();
+        unsigned long long First = (LtraceHead > LTRACE_CAPACITY) ? LtraceHead - LTRACE_CAPACITY : 0;
+
+        LbufferPutString(&Buffer, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+        for(unsigned long long Index = First; LtraceRing != GSNullPtr && Index < LtraceHead; Index++)
+        {
+                ltrace_event *Event = &LtraceRing[Index & (LTRACE_CAPACITY - 1)];
+                long Nanoseconds = (long)((Event->Ticks - ClockBaseTicks) / TicksPerNanosecond);
+
+                if(Index != First) LbufferPutString(&Buffer, ",\n");
+                LbufferPutString(&Buffer, "{\"name\": \"");
+                LbufferPutJsonString(&Buffer, Event->Name);
+                LbufferPutString(&Buffer, "\", \"ph\": \"");
+                LbufferPutChar(&Buffer, Event->Phase);
+                LbufferPutString(&Buffer, "\", \"pid\": 1, \"tid\": 1, \"ts\": ");
+                LbufferPutNumber(&Buffer, Nanoseconds / 1000);
+                LbufferPutChar(&Buffer, '.');
+                LbufferPutChar(&Buffer, '0' + (Nanoseconds / 100) % 10);
+                LbufferPutChar(&Buffer, '0' + (Nanoseconds / 10) % 10);
+                LbufferPutChar(&Buffer, '0' + Nanoseconds % 10);
+                LbufferPutString(&Buffer, ", \"args\": {\"depth\": ");
+                LbufferPutNumber(&Buffer, Event->Depth);
+                if(Event->Phase == 'B')
+                {
+                        LbufferPutString(&Buffer, ", \"cells\": ");
+                        LbufferPutNumber(&Buffer, Event->Cells);
+                }
+                LbufferPutString(&Buffer, "}}");
+
+                if(Buffer.Length > Buffer.Capacity - 256) LbufferFlushFd(&Buffer, Fd);
+        }
+        LbufferPutString(&Buffer, "\n]}\n");
+        LbufferFlushFd(&Buffer, Fd);
+}
+
+/* Returns false if the trace file couldn't be written. */
+gs_bool
+LtraceDump(void)
+{
+        if(LtraceFile == GSNullPtr) return(false);
+
+        int Fd = open(LtraceFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(Fd < 0) return(false);
+
+        LtraceWrite(Fd);
+        close(Fd);
+        return(true);
+}
+
+void
+LtraceSignalHandler(int Signal)
+{
+        int SavedErrno = errno;
+        LtraceDump();
+        errno = SavedErrno;
+}
+
+/* Starts recording; the ring is written to File by trace-dump, SIGUSR1 or on exit. */
+void
+LtraceStart(char *File)
+{
+        LtraceFile = File;
+        LtraceEnabled = true;
+
+        struct sigaction Action = {0};
+        Action.sa_handler = LtraceSignalHandler;
+        sigemptyset(&Action.sa_mask);
+        Action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &Action, GSNullPtr);
+}
+
+/******************************************************************************
+ * lsymbol Type and Functions
+ *-----------------------------------------------------------------------------
+ * Symbol names are interned, so every copy of a symbol shares one lsymbol and
+ * environments compare symbols by pointer. Evaluation consumes its input, and
+ * eval of a stored Q-Expression evaluates a fresh copy each time, so the
+ * symbol's resolution cache lives here where all of those copies can see it.
+ ******************************************************************************/
+
+struct lsymbol
+{
+        struct lsymbol *Next;
+        unsigned int Hash;
+
+        /*
+         * Index of the binding in the environment whose Version matches. Every
+         * thread looking the symbol up writes these, so they are only accessed
+         * atomically, and a hit is checked against the slot it names.
+         */
+        unsigned long long CacheVersion;
+        unsigned int CacheIndex;
+
+        char Name[];
+};
+typedef struct lsymbol lsymbol;
+
+static lsymbol **LsymbolTable = GSNullPtr;
+static unsigned int LsymbolTableSize = 0;
+static unsigned int LsymbolCount = 0;
+
+unsigned int
+LsymbolHash(char *Name, unsigned int Length)
+{
+        /* FNV-1a */
+        unsigned int Hash = 2166136261u;
+        for(unsigned char *C = (unsigned char *)Name; C < (unsigned char *)Name + Length; C++)
+        {
+                Hash = (Hash ^ *C) * 16777619u;
+        }
+        return(Hash);
+}
+
+void
+LsymbolTableGrow(void)
+{
+        unsigned int Size = GSMax(LsymbolTableSize * 2, 256);
+        lsymbol **Table = calloc(Size, sizeof(lsymbol *));
+
+        for(unsigned int Index = 0; Index < LsymbolTableSize; Index++)
+        {
+                lsymbol *Symbol = LsymbolTable[Index];
+                while(Symbol != GSNullPtr)
+                {
+                        lsymbol *Next = Symbol->Next;
+                        Symbol->Next = Table[Symbol->Hash & (Size - 1)];
+                        Table[Symbol->Hash & (Size - 1)] = Symbol;
+                        Symbol = Next;
+                }
+        }
+
+        free(LsymbolTable);
+        LsymbolTable = Table;
+        LsymbolTableSize = Size;
+}
+
+/* Interned symbols live until exit. */
+/* Name need not be terminated, so names can be interned straight from a blob. */
+lsymbol *
+LsymbolInternBytes(char *Name, unsigned int StringLength)
+{
+        unsigned int Hash = LsymbolHash(Name, StringLength);
+
+        if(LsymbolTableSize != 0)
+        {
+                for(lsymbol *Symbol = LsymbolTable[Hash & (LsymbolTableSize - 1)]; Symbol != GSNullPtr; Symbol = Symbol->Next)
+                {
+                        if(Symbol->Hash == Hash &&
+                           memcmp(Symbol->Name, Name, StringLength) == 0 &&
+                           Symbol->Name[StringLength] == '\0') return(Symbol);
+                }
+        }
+
+        if(LsymbolCount >= LsymbolTableSize) LsymbolTableGrow();
+
+        lsymbol *Result = LallocMalloc(LallocTag, sizeof(lsymbol) + StringLength + 1);
+        Result->Hash = Hash;
+        Result->CacheVersion = 0;
+        Result->CacheIndex = 0;
+        memcpy(Result->Name, Name, StringLength);
+        Result->Name[StringLength] = '\0';
+
+        Result->Next = LsymbolTable[Hash & (LsymbolTableSize - 1)];
+        LsymbolTable[Hash & (LsymbolTableSize - 1)] = Result;
+        LsymbolCount++;
+        return(Result);
+}
+
+lsymbol *
+LsymbolIntern(char *Name)
+{
+        return(LsymbolInternBytes(Name, GSStringLength(Name)));
+}
+
+/******************************************************************************
+ * lval Type and Functions
+ ******************************************************************************/
+
+struct lval
+{
+        /* Type of value. */
+        unsigned char Type;
+
+        /*
+         * If this is an S/Q-Expression, then track the cells. Cell arrays are
+         * allocated in powers of two, so only the exponent is kept; see
+         * LvalCellCapacity.
+         */
+        unsigned char CellCapacityLog2;
+
+        /* Shares the padding before CellCount, so an lval stays 16 bytes. */
+        union
+        {
+                /* If this is an error, which one; see lval_error_e. */
+                unsigned char ErrorCode;
+
+                /* If this is an S/Q-Expression, the line it was read from, or 0. */
+                unsigned short Line;
+        };
+        unsigned int CellCount;
+
+        /* Value for given type. */
+        union
+        {
+                long Number;
+                char *Error;
+                lsymbol *Symbol;
+                lbuiltin_info *BuiltIn;
+                struct lval **Cell;
+                llambda *Lambda;
+        };
+};
+
+enum lval_type_e
+{
+        LVAL_TYPE_NUMBER,
+        LVAL_TYPE_ERROR,
+        LVAL_TYPE_SYMBOL,
+        LVAL_TYPE_FUNCTION,
+        LVAL_TYPE_SEXPRESSION,
+        LVAL_TYPE_QEXPRESSION,
+        LVAL_TYPE_LAMBDA
+};
+
+enum lval_error_e
+{
+        LVAL_ERROR_DIV_ZERO,
+        LVAL_ERROR_BAD_OPERATOR,
+        LVAL_ERROR_BAD_NUMBER,
+        LVAL_ERROR_NOT_A_NUMBER,
+        LVAL_ERROR_UNBOUND_SYMBOL,
+        LVAL_ERROR_UNKNOWN_FUNCTION,
+        LVAL_ERROR_NOT_A_FUNCTION,
+        LVAL_ERROR_HEAD_ARGUMENTS,
+        LVAL_ERROR_HEAD_TYPE,
+        LVAL_ERROR_HEAD_EMPTY,
+        LVAL_ERROR_TAIL_ARGUMENTS,
+        LVAL_ERROR_TAIL_TYPE,
+        LVAL_ERROR_TAIL_EMPTY,
+        LVAL_ERROR_EVAL_ARGUMENTS,
+        LVAL_ERROR_EVAL_TYPE,
+        LVAL_ERROR_JOIN_TYPE,
+        LVAL_ERROR_NO_ALLOC_STATS,
+        LVAL_ERROR_NO_TRACE,
+        LVAL_ERROR_TRACE_WRITE,
+        LVAL_ERROR_LAMBDA_ARGUMENTS,
+        LVAL_ERROR_LAMBDA_FORMALS,
+        LVAL_ERROR_DEF_TYPE,
+        LVAL_ERROR_DEF_COUNT,
+        LVAL_ERROR_CALL_ARGUMENTS,
+        LVAL_ERROR_NO_MEMO,
+        LVAL_ERROR_FUEL,
+        LVAL_ERROR_MAX_BYTES,
+        LVAL_ERROR_SAVE_ARGUMENTS,
+        LVAL_ERROR_SAVE_TYPE,
+        LVAL_ERROR_SAVE_WRITE,
+        LVAL_ERROR_LOAD_ARGUMENTS,
+        LVAL_ERROR_LOAD_READ,
+        LVAL_ERROR_BAD_BLOB,
+        LVAL_ERROR_NO_RECLAIM,
+        LVAL_ERROR_NO_JIT,
+        LVAL_ERROR_NO_PROFILE,
+        LVAL_ERROR_PROFILE_WRITE,
+        LVAL_ERROR_NO_COUNTERS,
+        LVAL_ERROR_NO_LATENCY,
+        LVAL_ERROR_COUNT
+};
+
+#define LVAL_STATIC_ERROR(Code, Message) [Code] = { .Type = LVAL_TYPE_ERROR, .ErrorCode = Code, .Error = Message }
+
+/*
+ * Every error is one of these. They are never allocated or freed and copies
+ * share them, so failing costs no more than succeeding.
+ */
+static lval LvalErrors[LVAL_ERROR_COUNT] =
+{
+        LVAL_STATIC_ERROR(LVAL_ERROR_DIV_ZERO,         "Division by zero!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_BAD_OPERATOR,     "Unknown Operator"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_BAD_NUMBER,       "Invalid Number"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_NOT_A_NUMBER,     "Cannot operate on non-number"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_UNBOUND_SYMBOL,   "Unbound Symbol!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_UNKNOWN_FUNCTION, "Unknown Function!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_NOT_A_FUNCTION,   "First element is not a function!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_HEAD_ARGUMENTS,   "Function 'head' passed too many arguments!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_HEAD_TYPE,        "Function 'head' passed incorrect type!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_HEAD_EMPTY,       "Function 'head' passed {}!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_TAIL_ARGUMENTS,   "Function 'tail' passed too many arguments!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_TAIL_TYPE,        "Function 'tail' passed incorrect type!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_TAIL_EMPTY,       "Function 'tail' passed {}!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_EVAL_ARGUMENTS,   "Function 'eval' passed too many arguments!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_EVAL_TYPE,        "Function 'eval' passed incorrect type!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_JOIN_TYPE,        "Function 'join' passed incorrect type!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_NO_ALLOC_STATS,   "Allocation tracking not compiled in; build with -DLISPY_ALLOC_STATS -DMPC_ALLOC_HOOKS"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_NO_TRACE,         "Tracing is off; start with --trace trace_file"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_TRACE_WRITE,      "Couldn't write trace file!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_LAMBDA_ARGUMENTS, "Function '\\' passed incorrect arguments!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_LAMBDA_FORMALS,   "Function '\\' passed non-symbol parameter!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_DEF_TYPE,         "Function 'def' passed incorrect type!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_DEF_COUNT,        "Function 'def' passed incorrect number of values!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_CALL_ARGUMENTS,   "Function called with wrong number of arguments!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_NO_MEMO,          "Memoization not enabled, start with --memo bytes!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_FUEL,             "Evaluation ran out of fuel!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_MAX_BYTES,        "Evaluation exceeded its memory ceiling!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_SAVE_ARGUMENTS,   "Function 'save' passed incorrect arguments!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_SAVE_TYPE,        "Function 'save' can't serialize a lambda!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_SAVE_WRITE,       "Couldn't write binary file!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_LOAD_ARGUMENTS,   "Function 'load-bin' passed incorrect arguments!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_LOAD_READ,        "Couldn't read binary file!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_BAD_BLOB,         "Binary file is malformed!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_NO_RECLAIM,       "Reclaimer not running, start with --reclaim bytes!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_NO_JIT,           "JIT not enabled, start with --jit threshold!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_NO_PROFILE,       "Profiler has no output file, start with --profile file!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_PROFILE_WRITE,    "Couldn't write profile!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_NO_COUNTERS,      "Counters not open, start with --perf-counters!"),
+        LVAL_STATIC_ERROR(LVAL_ERROR_NO_LATENCY,       "Latency not recorded, start with --latency!"),
+};
+
+unsigned int
+LvalCellCapacity(lval *Self)
+{
+        return((Self->Cell == GSNullPtr) ? 0 : 1u << Self->CellCapacityLog2);
+}
+
+/*
+ * Grows Cell to hold at least Wanted cells. Cells are never shrunk. Capacity
+ * stops at 2^31 cells, so Wanted must not exceed that.
+ */
+void
+LvalReserveCells(lval *Self, unsigned int Wanted)
+{
+        if(Wanted <= LvalCellCapacity(Self)) return;
+
+        unsigned char Log2 = 0;
+        while(Log2 < 31 && (1u << Log2) < Wanted) Log2++;
+
+        Self->Cell = LallocRealloc(LallocTag, Self->Cell, sizeof(lval *) << Log2);
+        Self->CellCapacityLog2 = Log2;
+}
+
+lval *
+LvalNumber(long Number)
+{
+        lval *Self = LallocMalloc(LallocTag, sizeof(lval));
+        Self->Type = LVAL_TYPE_NUMBER;
+        Self->Number = Number;
+        return(Self);
+}
+
+lval *
+LvalError(enum lval_error_e Code)
+{
+        return(&LvalErrors[Code]);
+}
+
+lval *
+LvalSymbol(char *Symbol)
+{
+        lval *Self = LallocMalloc(LallocTag, sizeof(lval));
+        Self->Type = LVAL_TYPE_SYMBOL;
+        Self->Symbol = LsymbolIntern(Symbol);
+        return(Self);
+}
+
+lval *
+LvalFunction(lbuiltin_info *BuiltIn)
+{
+        lval *Self = LallocMalloc(LallocTag, sizeof(lval));
+        Self->Type = LVAL_TYPE_FUNCTION;
+        Self->BuiltIn = BuiltIn;
+        return(Self);
+}
+
+lval *
+LvalSExpression()
+{
+        lval *Self = LallocMalloc(LallocTag, sizeof(lval));
+        Self->Type = LVAL_TYPE_SEXPRESSION;
+        Self->Line = 0;
+        Self->CellCount = 0;
+        Self->Cell = GSNullPtr;
+        return(Self);
+}
+
+lval *
+LvalQExpression()
+{
+        lval *Self = LallocMalloc(LallocTag, sizeof(lval));
+        Self->Type = LVAL_TYPE_QEXPRESSION;
+        Self->Line = 0;
+        Self->CellCount = 0;
+        Self->Cell = GSNullPtr;
+        return(Self);
+}
+
+llambda *LlambdaRetain(llambda *Self);
+void LlambdaRelease(llambda *Self);
+
+/*
+ * Frees without recursion or a stack, by pointer reversal: cells are freed from
+ * the last one down, and the slot each child leaves behind holds the pointer
+ * back to its parent, so an expression's parent is always at Cell[CellCount].
+ */
+void
+LvalFree(lval *Self)
+{
+        lval *Parent = GSNullPtr;
+
+        while(true)
+        {
+                if((Self->Type == LVAL_TYPE_SEXPRESSION || Self->Type == LVAL_TYPE_QEXPRESSION) &&
+                   Self->CellCount > 0)
+                {
+                        lval *Child = Self->Cell[--Self->CellCount];
+                        Self->Cell[Self->CellCount] = Parent;
+                        Parent = Self;
+                        Self = Child;
+                        continue;
+                }
+
+                switch(Self->Type)
+                {
+                        case LVAL_TYPE_FUNCTION:                            break;
+                        case LVAL_TYPE_LAMBDA:      { LlambdaRelease(Self->Lambda); } break;
+                        case LVAL_TYPE_NUMBER:                              break;
+                        case LVAL_TYPE_ERROR:                               break;
+                        case LVAL_TYPE_SYMBOL:                              break;
+                        case LVAL_TYPE_QEXPRESSION:
+                        case LVAL_TYPE_SEXPRESSION: { LallocFree(Self->Cell); } break;
+                }
+                if(Self->Type != LVAL_TYPE_ERROR) LallocFree(Self);
+
+                if(Parent == GSNullPtr) return;
+                Self = Parent;
+                Parent = Self->Cell[Self->CellCount];
+        }
+}
+
+/* Copies Self without its cells; an expression gets room for them and a count of zero. */
+lval *
+LvalCopyNode(lval *Self)
+{
+        if(Self->Type == LVAL_TYPE_ERROR) return(Self);
+
+        lval *Result = LallocMalloc(LallocTag, sizeof(lval));
+        Result->Type = Self->Type;
+
+        switch(Self->Type)
+        {
+                case(LVAL_TYPE_FUNCTION):
+                {
+                        Result->BuiltIn = Self->BuiltIn;
+                        break;
+                }
+                case(LVAL_TYPE_LAMBDA):
+                {
+                        Result->Lambda = LlambdaRetain(Self->Lambda);
+                        break;
+                }
+                case(LVAL_TYPE_NUMBER):
+                {
+                        Result->Number = Self->Number;
+                        break;
+                }
+                case(LVAL_TYPE_SYMBOL):
+                {
+                        Result->Symbol = Self->Symbol;
+                        break;
+                }
+                case(LVAL_TYPE_SEXPRESSION):
+                case(LVAL_TYPE_QEXPRESSION):
+                {
+                        Result->Line = Self->Line;
+                        Result->CellCount = 0;
+                        Result->Cell = GSNullPtr;
+                        LvalReserveCells(Result, Self->CellCount);
+                        break;
+                }
+        }
+
+        return(Result);
+}
+
+/* Expressions being copied; a copy's CellCount is how many cells are done. */
+struct lcopy_frame
+{
+        lval *Source;
+        lval *Copy;
+};
+
+static __thread struct lcopy_frame *LvalCopyStack = GSNullPtr;
+static __thread unsigned int LvalCopyStackCapacity = 0;
+
+/* Copies without recursion so copy depth isn't bounded by the C stack. */
+lval *
+LvalCopy(lval *Self)
+{
+        lval *Result = LvalCopyNode(Self);
+        if(Self->Type != LVAL_TYPE_SEXPRESSION && Self->Type != LVAL_TYPE_QEXPRESSION) return(Result);
+
+        unsigned int Depth = 0;
+        lval *Source = Self;
+        lval *Copy = Result;
+        while(true)
+        {
+                if(Source != GSNullPtr && Source->CellCount > 0)
+                {
+                        if(Depth == LvalCopyStackCapacity)
+                        {
+                                LvalCopyStackCapacity = GSMax(LvalCopyStackCapacity * 2, 64);
+                                LvalCopyStack = realloc(LvalCopyStack,
+                                                        sizeof(struct lcopy_frame) * LvalCopyStackCapacity);
+                        }
+                        LvalCopyStack[Depth].Source = Source;
+                        LvalCopyStack[Depth].Copy = Copy;
+                        Depth++;
+                }
+
+                /* Copy the next cell of the innermost unfinished expression. */
+                while(Depth > 0 && LvalCopyStack[Depth - 1].Copy->CellCount ==
+                                   LvalCopyStack[Depth - 1].Source->CellCount)
+                {
+                        Depth--;
+                }
+                if(Depth == 0) return(Result);
+
+                struct lcopy_frame *Top = &LvalCopyStack[Depth - 1];
+                Source = Top->Source->Cell[Top->Copy->CellCount];
+                Copy = LvalCopyNode(Source);
+                Top->Copy->Cell[Top->Copy->CellCount++] = Copy;
+
+                if(Source->Type != LVAL_TYPE_SEXPRESSION && Source->Type != LVAL_TYPE_QEXPRESSION)
+                {
+                        Source = GSNullPtr;
+                }
+        }
+}
+
+gs_bool
+LvalIsEqual(lval *Left, lval *Right)
+{
+        if(Left->Type != Right->Type) return(false);
+
+        switch(Left->Type)
+        {
+                case(LVAL_TYPE_ERROR):    return(Left->ErrorCode == Right->ErrorCode);
+                case(LVAL_TYPE_NUMBER):   return(Left->Number == Right->Number);
+                case(LVAL_TYPE_SYMBOL):   return(Left->Symbol == Right->Symbol);
+                case(LVAL_TYPE_FUNCTION): return(Left->BuiltIn == Right->BuiltIn);
+                case(LVAL_TYPE_LAMBDA):   return(Left->Lambda == Right->Lambda);
+                case(LVAL_TYPE_SEXPRESSION):
+                case(LVAL_TYPE_QEXPRESSION):
+                {
+                        if(Left->CellCount != Right->CellCount) return(false);
+                        for(int Index = 0; Index < Left->CellCount; Index++)
+                        {
+                                if(!LvalIsEqual(Left->Cell[Index], Right->Cell[Index])) return(false);
+                        }
+                        return(true);
+                }
+        }
+
+        return(false);
+}
+
+lval *
+LvalReadNumber(mpc_ast_t *Tree)
+{
+        lval *Result;
+
+        /* The grammar has already matched /-?[0-9]+/, so skip strtol. */
+        long Number;
+        if(!mpc_strtol_dec(Tree->contents, &Number))
+        {
+                Result = LvalError(LVAL_ERROR_BAD_NUMBER);
+        }
+        else
+        {
+                Result = LvalNumber(Number);
+        }
+        return(Result);
+}
+
+lval *
+LvalAdd(lval *Self, lval *ToAdd)
+{
+        LvalReserveCells(Self, Self->CellCount + 1);
+        Self->CellCount++;
+        Self->Cell[Self->CellCount-1] = ToAdd;
+        return(Self);
+}
+
+/* Brackets and the regex anchors around the root carry no value. */
+gs_bool
+LvalReadIsPunctuation(mpc_ast_t *Tree)
+{
+        if(GSStringIsEqual(Tree->contents, "(", 1)) return(true);
+        if(GSStringIsEqual(Tree->contents, ")", 1)) return(true);
+        if(GSStringIsEqual(Tree->contents, "}", 1)) return(true);
+        if(GSStringIsEqual(Tree->contents, "{", 1)) return(true);
+        if(GSStringIsEqual(Tree->tag, "regex", 5))  return(true);
+        return(false);
+}
+
+/* Expressions being read; Index is the AST child read last. */
+struct lread_frame
+{
+        mpc_ast_t *Tree;
+        lval *Expression;
+        int Index;
+};
+
+static __thread struct lread_frame *LvalReadStack = GSNullPtr;
+static __thread unsigned int LvalReadStackCapacity = 0;
+
+/* Reads without recursion so input depth isn't bounded by the C stack. */
+lval *
+LvalRead(mpc_ast_t *Tree)
+{
+        unsigned int Depth = 0;
+
+        while(true)
+        {
+                lval *Value = GSNullPtr;
+
+                if(GSStringHasSubstring(Tree->tag, 0, "number", 6))     Value = LvalReadNumber(Tree);
+                else if(GSStringHasSubstring(Tree->tag, 0, "symbol", 6)) Value = LvalSymbol(Tree->contents);
+                else
+                {
+                        if(Depth == LvalReadStackCapacity)
+                        {
+                                LvalReadStackCapacity = GSMax(LvalReadStackCapacity * 2, 64);
+                                LvalReadStack = realloc(LvalReadStack,
+                                                        sizeof(struct lread_frame) * LvalReadStackCapacity);
+                        }
+                        LvalReadStack[Depth].Tree = Tree;
+                        LvalReadStack[Depth].Expression = GSStringHasSubstring(Tree->tag, 0, "qexpr", 5) ?
+                                                          LvalQExpression() : LvalSExpression();
+                        LvalReadStack[Depth].Expression->Line = GSMin(Tree->state.row + 1, 0xFFFF);
+                        LvalReadStack[Depth].Index = -1;
+                        Depth++;
+                }
+
+                /* Add the finished value to its parent and find the next child to read. */
+                while(Depth > 0)
+                {
+                        struct lread_frame *Top = &LvalReadStack[Depth - 1];
+                        if(Value != GSNullPtr) LvalAdd(Top->Expression, Value);
+
+                        do Top->Index++;
+                        while(Top->Index < Top->Tree->children_num &&
+                              LvalReadIsPunctuation(Top->Tree->children[Top->Index]));
+
+                        if(Top->Index < Top->Tree->children_num)
+                        {
+                                Tree = Top->Tree->children[Top->Index];
+                                break;
+                        }
+
+                        Value = Top->Expression;
+                        Depth--;
+                }
+
+                if(Depth == 0) return(Value);
+        }
+}
+
+/* Pending S/Q-Expressions while rendering; reused between calls. */
+struct lprint_frame
+{
+        lval *Expression;
+        unsigned int Index;
+};
+
+static __thread struct lprint_frame *LvalPrintStack = GSNullPtr;
+static __thread unsigned int LvalPrintStackCapacity = 0;
+
+/* Renders without recursion so output depth isn't bounded by the C stack. */
+void
+LvalRender(lbuffer *Buffer, lval *Self)
+{
+        unsigned int Depth = 0;
+
+        while(true)
+        {
+                switch(Self->Type)
+                {
+                        case(LVAL_TYPE_FUNCTION): LbufferPutString(Buffer, "<function>"); break;
+                        case(LVAL_TYPE_LAMBDA):   LbufferPutString(Buffer, "<lambda>"); break;
+                        case(LVAL_TYPE_NUMBER):   LbufferPutNumber(Buffer, Self->Number); break;
+                        case(LVAL_TYPE_ERROR):
+                        {
+                                LbufferPutString(Buffer, "Error: ");
+                                LbufferPutString(Buffer, Self->Error);
+                        } break;
+                        case(LVAL_TYPE_SYMBOL):   LbufferPutString(Buffer, Self->Symbol->Name); break;
+                        case(LVAL_TYPE_SEXPRESSION):
+                        case(LVAL_TYPE_QEXPRESSION):
+                        {
+                                int IsQ = (Self->Type == LVAL_TYPE_QEXPRESSION);
+                                LbufferPutChar(Buffer, IsQ ? '{' : '(');
+                                if(Self->CellCount == 0)
+                                {
+                                        LbufferPutChar(Buffer, IsQ ? '}' : ')');
+                                        break;
+                                }
+
+                                if(Depth == LvalPrintStackCapacity)
+                                {
+                                        LvalPrintStackCapacity = GSMax(LvalPrintStackCapacity * 2, 64);
+                                        LvalPrintStack = realloc(LvalPrintStack,
+                                                                 sizeof(struct lprint_frame) * LvalPrintStackCapacity);
+                                }
+                                LvalPrintStack[Depth].Expression = Self;
+                                LvalPrintStack[Depth].Index = 0;
+                                Depth++;
+
+                                Self = Self->Cell[0];
+                                continue;
+                        }
+                }
+
+                /* Finished a value; move to the next sibling, closing exhausted parents. */
+                while(Depth > 0)
+                {
+                        struct lprint_frame *Top = &LvalPrintStack[Depth - 1];
+                        Top->Index++;
+                        if(Top->Index < Top->Expression->CellCount)
+                        {
+                                LbufferPutChar(Buffer, ' ');
+                                Self = Top->Expression->Cell[Top->Index];
+                                break;
+                        }
+
+                        LbufferPutChar(Buffer, (Top->Expression->Type == LVAL_TYPE_QEXPRESSION) ? '}' : ')');
+                        Depth--;
+                }
+
+                if(Depth == 0) return;
+        }
+}
+
+static lbuffer LvalPrintBuffer;
+
+void
+LvalPrint(lval *Self)
+{
+        LvalRender(&LvalPrintBuffer, Self);
+        LbufferFlush(&LvalPrintBuffer, stdout);
+}
+
+/* Returns the number of bytes printed. */
+size_t
+LvalPrintLine(lval *Self)
+{
+        LvalRender(&LvalPrintBuffer, Self);
+        LbufferPutChar(&LvalPrintBuffer, '\n');
+        size_t Result = LvalPrintBuffer.Length;
+        LbufferFlush(&LvalPrintBuffer, stdout);
+        return(Result);
+}
+
+lval *
+LvalPop(lval *Self, unsigned int Index)
+{
+        lval *Result = Self->Cell[Index];
+
+        GSMemoryCopy(&(Self->Cell[Index + 1]), &(Self->Cell[Index]),
+                     sizeof(lval *) * (Self->CellCount - Index - 1));
+
+        Self->CellCount--;
+        return(Result);
+}
+
+lval *
+LvalTake(lval *Self, unsigned int Index)
+{
+        lval *Result = LvalPop(Self, Index);
+        LvalFree(Self);
+        return(Result);
+}
+
+/******************************************************************************
+ * lenv Type and Functions
+ *-----------------------------------------------------------------------------
+ * The global environment is published to readers as an immutable snapshot:
+ * an lenv behind an atomically swapped Snapshot pointer. Worker threads look
+ * up globals without locks or retries while the main thread, the only writer,
+ * defines new ones.
+ *
+ * Appending a binding writes the slot past Count and then publishes the new
+ * Count, so existing snapshots stay valid and appends cost no copy. Replacing
+ * a binding, or appending to a full snapshot, copies the arrays into a new
+ * snapshot and swaps it in. The old one is retired, and freed with the value
+ * it replaced once no reader can still be using it.
+ *
+ * Reclamation is epoch based. A reader records the global epoch in its slot
+ * for the duration of a lookup. Retiring a snapshot advances the epoch, and a
+ * retired snapshot is freed once every reader's slot is idle or newer than
+ * the epoch it was retired in. The main thread frees snapshots itself, so its
+ * own lookups skip the slot entirely.
+ ******************************************************************************/
+
+/*
+ * Version changes whenever a binding is replaced. Versions come from one global
+ * counter, so a symbol's cached version can only ever match one environment.
+ * Appending a binding doesn't move existing ones, so it leaves Version alone.
+ *
+ * Lookups that miss continue in Parent. The global environment has none.
+ *
+ * Lambda calls get a frame: an lenv whose Symbols are borrowed from the
+ * lambda's parameter list, so Values is indexed by parameter position. Closures
+ * share the frame they were created in rather than copying it, so frames are
+ * reference counted, and a released frame goes back to LenvFramePool with its
+ * Values array for the next call to reuse.
+ */
+struct lenv
+{
+        unsigned int Count;
+        lsymbol **Symbols;
+        lval **Values;
+        unsigned long long Version;
+
+        lenv *Parent;
+        gs_bool IsFrame;
+        unsigned int RefCount;
+        unsigned int Capacity;
+
+        /* Global environment only: the current snapshot and those awaiting free. */
+        lenv *Snapshot;
+        lenv *Retired;
+
+        /* Retired snapshots only: the value the next snapshot replaced, and when. */
+        lval *Replaced;
+        unsigned long long RetiredEpoch;
+};
+
+static unsigned long long LenvNextVersion = 1;
+static lenv *LenvFramePool = GSNullPtr;
+
+/*
+ * Set on every thread but the main one. Workers may read the global
+ * environment but never write it, and hand lambda releases back.
+ */
+static __thread gs_bool LthreadIsWorker = false;
+
+/* Padded so readers on different cores don't share a cache line. */
+struct lepoch_slot
+{
+        unsigned long long Epoch;
+        gs_bool InUse;
+        char Padding[64 - sizeof(unsigned long long) - sizeof(gs_bool)];
+};
+
+#define LEPOCH_SLOTS 64
+
+static struct lepoch_slot LepochSlots[LEPOCH_SLOTS];
+static unsigned long long LepochGlobal = 1;
+static __thread struct lepoch_slot *LepochSlot = GSNullPtr;
+
+void
+LepochClaim(void)
+{
+        for(int Index = 0; Index < LEPOCH_SLOTS; Index++)
+        {
+                gs_bool Expected = false;
+                if(__atomic_compare_exchange_n(&LepochSlots[Index].InUse, &Expected, true, false,
+                                               __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                {
+                        LepochSlot = &LepochSlots[Index];
+                        return;
+                }
+        }
+        GSAbortWithMessage("Too many reader threads!\n");
+}
+
+/* Called by a worker before it exits. */
+void
+LepochRelease(void)
+{
+        if(LepochSlot == GSNullPtr) return;
+        __atomic_store_n(&LepochSlot->InUse, false, __ATOMIC_RELEASE);
+        LepochSlot = GSNullPtr;
+}
+
+/* Sequentially consistent, so the slot is stored before the reader loads Snapshot. */
+void
+LepochEnter(void)
+{
+        if(LepochSlot == GSNullPtr) LepochClaim();
+        __atomic_store_n(&LepochSlot->Epoch, __atomic_load_n(&LepochGlobal, __ATOMIC_RELAXED), __ATOMIC_SEQ_CST);
+}
+
+void
+LepochExit(void)
+{
+        __atomic_store_n(&LepochSlot->Epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* Returns the oldest epoch a reader is in, or ~0 if none is reading. */
+unsigned long long
+LepochOldest(void)
+{
+        unsigned long long Result = ~0ULL;
+        for(int Index = 0; Index < LEPOCH_SLOTS; Index++)
+        {
+                unsigned long long Epoch = __atomic_load_n(&LepochSlots[Index].Epoch, __ATOMIC_SEQ_CST);
+                if(Epoch != 0 && Epoch < Result) Result = Epoch;
+        }
+        return(Result);
+}
+
+/* Copies From's bindings, which are shared, not copied themselves. */
+lenv *
+LenvSnapshotNew(lenv *From, unsigned int Capacity)
+{
+        lenv *Result = LallocMalloc(LALLOC_TAG_ENV, sizeof(lenv));
+        Result->Count = From ? From->Count : 0;
+        Result->Capacity = Capacity;
+        Result->Symbols = LallocMalloc(LALLOC_TAG_ENV, sizeof(lsymbol *) * Capacity);
+        Result->Values = LallocMalloc(LALLOC_TAG_ENV, sizeof(lval *) * Capacity);
+        if(From != GSNullPtr)
+        {
+                GSMemoryCopy(From->Symbols, Result->Symbols, sizeof(lsymbol *) * From->Count);
+                GSMemoryCopy(From->Values, Result->Values, sizeof(lval *) * From->Count);
+        }
+        Result->Version = From ? From->Version : LenvNextVersion++;
+        Result->Parent = GSNullPtr;
+        Result->IsFrame = false;
+        Result->RefCount = 1;
+        Result->Snapshot = GSNullPtr;
+        Result->Retired = GSNullPtr;
+        Result->Replaced = GSNullPtr;
+        return(Result);
+}
+
+/* Bindings are shared with the snapshot that replaced this one; only Replaced is owned. */
+void
+LenvSnapshotFree(lenv *Self)
+{
+        if(Self->Replaced != GSNullPtr) LvalFree(Self->Replaced);
+        LallocFree(Self->Symbols);
+        LallocFree(Self->Values);
+        LallocFree(Self);
+}
+
+/* Frees the retired snapshots no reader can still be using. */
+void
+LenvCollect(lenv *Self)
+{
+        unsigned long long Oldest = LepochOldest();
+        lenv **Link = &Self->Retired;
+        while(*Link != GSNullPtr)
+        {
+                lenv *Snapshot = *Link;
+                if(Snapshot->RetiredEpoch < Oldest)
+                {
+                        *Link = Snapshot->Retired;
+                        LenvSnapshotFree(Snapshot);
+                }
+                else
+                {
+                        Link = &Snapshot->Retired;
+                }
+        }
+}
+
+/* Swaps in Next. Replaced is freed along with the old snapshot. */
+void
+LenvPublish(lenv *Self, lenv *Next, lval *Replaced)
+{
+        lenv *Old = Self->Snapshot;
+        __atomic_store_n(&Self->Snapshot, Next, __ATOMIC_SEQ_CST);
+
+        Old->Replaced = Replaced;
+        Old->RetiredEpoch = __atomic_fetch_add(&LepochGlobal, 1, __ATOMIC_SEQ_CST);
+        Old->Retired = Self->Retired;
+        Self->Retired = Old;
+        LenvCollect(Self);
+}
+
+/* Returns a new, empty global environment. */
+lenv *
+LenvNew(void)
+{
+        lenv *Result = LallocMalloc(LALLOC_TAG_ENV, sizeof(lenv));
+        Result->Count = 0;
+        Result->Symbols = GSNullPtr;
+        Result->Values = GSNullPtr;
+        Result->Version = 0;
+        Result->Parent = GSNullPtr;
+        Result->IsFrame = false;
+        Result->RefCount = 1;
+        Result->Capacity = 0;
+        Result->Snapshot = LenvSnapshotNew(GSNullPtr, 16);
+        Result->Retired = GSNullPtr;
+        return(Result);
+}
+
+/* Only frames are counted; the global environment lives until LenvFree. */
+lenv *
+LenvRetain(lenv *Self)
+{
+        if(Self->IsFrame) Self->RefCount++;
+        return(Self);
+}
+
+/*
+ * Values are left for the caller to fill in, one per parameter. Parameters
+ * are copied, since a closure can keep the frame alive after its lambda.
+ */
+lenv *
+LenvFrameNew(lenv *Parent, lsymbol **Parameters, unsigned int Count)
+{
+        lenv *Result = LenvFramePool;
+        if(Result != GSNullPtr)
+        {
+                LenvFramePool = Result->Parent;
+        }
+        else
+        {
+                Result = LallocMalloc(LALLOC_TAG_ENV, sizeof(lenv));
+                Result->Symbols = GSNullPtr;
+                Result->Values = GSNullPtr;
+                Result->Capacity = 0;
+                Result->IsFrame = true;
+                Result->Snapshot = GSNullPtr;
+                Result->Retired = GSNullPtr;
+        }
+
+        if(Count > Result->Capacity)
+        {
+                Result->Symbols = LallocRealloc(LALLOC_TAG_ENV, Result->Symbols, sizeof(lsymbol *) * Count);
+                Result->Values = LallocRealloc(LALLOC_TAG_ENV, Result->Values, sizeof(lval *) * Count);
+                Result->Capacity = Count;
+        }
+
+        Result->Count = Count;
+        GSMemoryCopy(Parameters, Result->Symbols, sizeof(lsymbol *) * Count);
+        Result->Version = LenvNextVersion++;
+        Result->Parent = LenvRetain(Parent);
+        Result->RefCount = 1;
+        return(Result);
+}
+
+void
+LenvRelease(lenv *Self)
+{
+        while(Self->IsFrame && --Self->RefCount == 0)
+        {
+                lenv *Parent = Self->Parent;
+                for(int Index = 0; Index < Self->Count; Index++)
+                {
+                        LvalFree(Self->Values[Index]);
+                }
+
+                Self->Parent = LenvFramePool;
+                LenvFramePool = Self;
+                Self = Parent;
+        }
+}
+
+void
+LenvFramePoolFree(void)
+{
+        while(LenvFramePool != GSNullPtr)
+        {
+                lenv *Next = LenvFramePool->Parent;
+                LallocFree(LenvFramePool->Symbols);
+                LallocFree(LenvFramePool->Values);
+                LallocFree(LenvFramePool);
+                LenvFramePool = Next;
+        }
+}
+
+/* Frees a global environment. No worker may still be reading it. */
+void
+LenvFree(lenv *Self)
+{
+        lenv *Snapshot = Self->Snapshot;
+        for(int Index = 0; Index < Snapshot->Count; Index++)
+        {
+                LvalFree(Snapshot->Values[Index]);
+        }
+        LenvSnapshotFree(Snapshot);
+
+        while(Self->Retired != GSNullPtr)
+        {
+                lenv *Next = Self->Retired->Retired;
+                LenvSnapshotFree(Self->Retired);
+                Self->Retired = Next;
+        }
+        LallocFree(Self);
+}
+
+/*
+ * Returns the binding in this level only, not a copy, or null. Count is read
+ * once, since a global snapshot may grow while it is searched.
+ */
+lval *
+LenvFind(lenv *Env, lsymbol *Symbol)
+{
+        unsigned int Count = __atomic_load_n(&Env->Count, __ATOMIC_ACQUIRE);
+
+        unsigned int Cached = __atomic_load_n(&Symbol->CacheIndex, __ATOMIC_RELAXED);
+        if(__atomic_load_n(&Symbol->CacheVersion, __ATOMIC_RELAXED) == Env->Version &&
+           Cached < Count && Env->Symbols[Cached] == Symbol)
+        {
+                return(Env->Values[Cached]);
+        }
+
+        for(unsigned int Index = 0; Index < Count; Index++)
+        {
+                if(Env->Symbols[Index] == Symbol)
+                {
+                        __atomic_store_n(&Symbol->CacheVersion, Env->Version, __ATOMIC_RELAXED);
+                        __atomic_store_n(&Symbol->CacheIndex, Index, __ATOMIC_RELAXED);
+                        return(Env->Values[Index]);
+                }
+        }
+        return(GSNullPtr);
+}
+
+/*
+ * Returns the binding Self sees, not a copy, or null. Main thread only, since
+ * the global snapshot is read without an epoch. Each frame is checked before
+ * its parent, so parameters shadow globals.
+ */
+lval *
+LenvLookup(lenv *Self, lsymbol *Symbol)
+{
+        for(; Self->IsFrame; Self = Self->Parent)
+        {
+                lval *Value = LenvFind(Self, Symbol);
+                if(Value != GSNullPtr) return(Value);
+        }
+        return(LenvFind(Self->Snapshot, Symbol));
+}
+
+lval *
+LenvGet(lenv *Self, lval *Key)
+{
+        lsymbol *Symbol = Key->Symbol;
+        lval *Value;
+
+        if(!LthreadIsWorker)
+        {
+                Value = LenvLookup(Self, Symbol);
+                return(Value ? LvalCopy(Value) : LvalError(LVAL_ERROR_UNBOUND_SYMBOL));
+        }
+
+        lenv *Env = Self;
+        for(; Env->IsFrame; Env = Env->Parent)
+        {
+                Value = LenvFind(Env, Symbol);
+                if(Value != GSNullPtr) return(LvalCopy(Value));
+        }
+
+        LepochEnter();
+        Value = LenvFind(__atomic_load_n(&Env->Snapshot, __ATOMIC_SEQ_CST), Symbol);
+        lval *Result = Value ? LvalCopy(Value) : LvalError(LVAL_ERROR_UNBOUND_SYMBOL);
+        LepochExit();
+        return(Result);
+}
+
+/* Binds Key in a global environment. Main thread only. */
+void
+LenvPut(lenv *Self, lval *Key, lval *Value)
+{
+        LallocTagPush(LALLOC_TAG_ENV);
+
+        lenv *Snapshot = Self->Snapshot;
+        for(int Index = 0; Index < Snapshot->Count; Index++)
+        {
+                if(Snapshot->Symbols[Index] == Key->Symbol)
+                {
+                        lenv *Next = LenvSnapshotNew(Snapshot, Snapshot->Capacity);
+                        Next->Values[Index] = LvalCopy(Value);
+                        Next->Version = LenvNextVersion++;
+                        LenvPublish(Self, Next, Snapshot->Values[Index]);
+                        LallocTagPop();
+                        return;
+                }
+        }
+
+        /* Indices don't move, so a grown snapshot keeps its Version and cached lookups. */
+        if(Snapshot->Count == Snapshot->Capacity)
+        {
+                lenv *Next = LenvSnapshotNew(Snapshot, Snapshot->Capacity * 2);
+                LenvPublish(Self, Next, GSNullPtr);
+                Snapshot = Next;
+        }
+
+        Snapshot->Values[Snapshot->Count] = LvalCopy(Value);
+        Snapshot->Symbols[Snapshot->Count] = Key->Symbol;
+        __atomic_store_n(&Snapshot->Count, Snapshot->Count + 1, __ATOMIC_RELEASE);
+
+        LallocTagPop();
+}
+
+/* def always binds in the global environment. */
+void
+LenvDef(lenv *Self, lval *Key, lval *Value)
+{
+        while(Self->Parent != GSNullPtr) Self = Self->Parent;
+        LenvPut(Self, Key, Value);
+}
+
+/******************************************************************************
+ * llambda Type and Functions
+ ******************************************************************************/
+
+struct llambda
+{
+        unsigned int RefCount;
+        unsigned int Arity;
+        lsymbol **Parameters;
+
+        /* Q-Expression, copied and evaluated as an S-Expression on each call. */
+        lval *Body;
+
+        /* Shared with other closures made in the same environment, not copied. */
+        lenv *Env;
+
+        /* Native code for the body once it has been called --jit times. */
+        unsigned int Calls;
+        struct ljit_code *Jit;
+        gs_bool JitFailed;
+};
+
+void LreclaimDeferLambda(llambda *Self);
+void LjitCodeFree(struct ljit_code *Self);
+
+/* Takes ownership of Formals, which must be all symbols, and Body. */
+lval *
+LvalLambda(lenv *Env, lval *Formals, lval *Body)
+{
+        llambda *Lambda = LallocMalloc(LallocTag, sizeof(llambda));
+        Lambda->RefCount = 1;
+        Lambda->Arity = Formals->CellCount;
+        Lambda->Parameters = LallocMalloc(LallocTag, sizeof(lsymbol *) * GSMax(Lambda->Arity, 1));
+        for(int Index = 0; Index < Lambda->Arity; Index++)
+        {
+                Lambda->Parameters[Index] = Formals->Cell[Index]->Symbol;
+        }
+        Lambda->Body = Body;
+        Lambda->Env = LenvRetain(Env);
+        Lambda->Calls = 0;
+        Lambda->Jit = GSNullPtr;
+        Lambda->JitFailed = false;
+        LvalFree(Formals);
+
+        lval *Self = LallocMalloc(LallocTag, sizeof(lval));
+        Self->Type = LVAL_TYPE_LAMBDA;
+        Self->Lambda = Lambda;
+        return(Self);
+}
+
+/* Workers copy lambdas out of the global environment, so counts are atomic. */
+llambda *
+LlambdaRetain(llambda *Self)
+{
+        __atomic_add_fetch(&Self->RefCount, 1, __ATOMIC_RELAXED);
+        return(Self);
+}
+
+/*
+ * Frames aren't thread safe, so a release on a worker thread is handed back
+ * to the main thread instead.
+ */
+void
+LlambdaRelease(llambda *Self)
+{
+        if(LthreadIsWorker)
+        {
+                LreclaimDeferLambda(Self);
+                return;
+        }
+
+        if(__atomic_sub_fetch(&Self->RefCount, 1, __ATOMIC_ACQ_REL) != 0) return;
+
+        LenvRelease(Self->Env);
+        LvalFree(Self->Body);
+        LjitCodeFree(Self->Jit);
+        LallocFree(Self->Parameters);
+        LallocFree(Self);
+}
+
+lval *LispEval(lenv *Env, lval *Self);
+gs_bool LjitRunLambda(llambda *Lambda, lenv *Frame, long *Number);
+
+/*
+ * Arguments are moved into a pooled frame rather than copied. The body still
+ * has to be copied, since evaluation consumes its input.
+ */
+lval *
+LvalCall(lval *Function, lval *Arguments)
+{
+        llambda *Lambda = Function->Lambda;
+        if(Arguments->CellCount != Lambda->Arity)
+        {
+                LvalFree(Arguments);
+                return(LvalError(LVAL_ERROR_CALL_ARGUMENTS));
+        }
+
+        lenv *Frame = LenvFrameNew(Lambda->Env, Lambda->Parameters, Lambda->Arity);
+        for(int Index = 0; Index < Lambda->Arity; Index++)
+        {
+                Frame->Values[Index] = Arguments->Cell[Index];
+        }
+        Arguments->CellCount = 0;
+        LvalFree(Arguments);
+
+        long Number = 0;
+        if(LjitRunLambda(Lambda, Frame, &Number))
+        {
+                LenvRelease(Frame);
+                return(LvalNumber(Number));
+        }
+
+        lval *Body = LvalCopy(Lambda->Body);
+        Body->Type = LVAL_TYPE_SEXPRESSION;
+        lval *Result = LispEval(Frame, Body);
+
+        LenvRelease(Frame);
+        return(Result);
+}
+
+/******************************************************************************
+ * Profiler
+ *-----------------------------------------------------------------------------
+ * --profile file samples evaluation on SIGPROF, by default 1000 times per
+ * second of CPU time. The main thread keeps a shadow stack of the calls in
+ * progress, each named by the head of its S-Expression and the line it was
+ * read from, and the handler counts each distinct stack it sees. Samples
+ * taken on worker threads or between evaluations get a frame of their own.
+ *
+ * profile-stop, or exit, writes the counts as folded stacks, one
+ * "frame;frame;... count" line per stack, for flamegraph.pl or speedscope.
+ * profile-start clears the counts and starts sampling again.
+ *
+ * The handler allocates nothing: stacks are interned into fixed tables, and
+ * samples that don't fit are counted as dropped. While the profiler is off
+ * each push and pop is one well predicted branch on LprofileEnabled.
+ ******************************************************************************/
+
+#define LPROFILE_DEPTH 128
+#define LPROFILE_STACKS 4096
+#define LPROFILE_PROBES 64
+#define LPROFILE_FRAMES (1 << 16)
+
+struct lprofile_frame
+{
+        char *Name;
+        unsigned int Line;
+};
+typedef struct lprofile_frame lprofile_frame;
+
+struct lprofile_stack
+{
+        unsigned long long Hash;
+        unsigned long long Samples;
+        unsigned int First;
+        unsigned int Depth;
+};
+
+static volatile sig_atomic_t LprofileEnabled = false;
+static char *LprofileFile = GSNullPtr;
+static unsigned int LprofileHertz = 1000;
+
+/* Where lines in frames come from: the script, or <stdin> in the repl. */
+static char *LprofileSource = "<stdin>";
+
+/* The main thread's calls in progress. Depth counts past LPROFILE_DEPTH. */
+static lprofile_frame LprofileShadow[LPROFILE_DEPTH];
+static volatile unsigned int LprofileDepth = 0;
+
+static lprofile_frame LprofileWorkerFrame = { "[worker thread]", 0 };
+static lprofile_frame LprofileIdleFrame = { "[outside eval]", 0 };
+
+static struct lprofile_stack LprofileStacks[LPROFILE_STACKS];
+static lprofile_frame LprofileFrames[LPROFILE_FRAMES];
+static unsigned int LprofileFrameCount = 0;
+static unsigned int LprofileStackCount = 0;
+static unsigned long long LprofileSamples = 0;
+static unsigned long long LprofileDropped = 0;
+
+/* Held by the handler and by profile-start and profile-stop. */
+static int LprofileBusy = 0;
+
+#define LprofileEnter(Name, Line) if(__builtin_expect(LprofileEnabled, false)) LprofilePush((Name), (Line))
+#define LprofileExit() if(__builtin_expect(LprofileEnabled, false)) LprofilePop()
+
+__attribute__((noinline)) void
+LprofilePush(char *Name, unsigned int Line)
+{
+        if(LthreadIsWorker) return;
+
+        unsigned int Depth = LprofileDepth;
+        if(Depth < LPROFILE_DEPTH)
+        {
+                LprofileShadow[Depth].Name = Name;
+                LprofileShadow[Depth].Line = Line;
+        }
+        /* The handler must not see the new depth before the frame. */
+        __atomic_signal_fence(__ATOMIC_RELEASE);
+        LprofileDepth = Depth + 1;
+}
+
+/* Calls that began before profile-start were never pushed, hence the check. */
+__attribute__((noinline)) void
+LprofilePop(void)
+{
+        if(!LthreadIsWorker && LprofileDepth > 0) LprofileDepth--;
+}
+
+/* Counts a sample of Frames, interning the stack if it's new. Handler only. */
+void
+LprofileRecord(lprofile_frame *Frames, unsigned int Depth)
+{
+        unsigned long long Hash = 14695981039346656037ULL;
+        for(unsigned int Index = 0; Index < Depth; Index++)
+        {
+                Hash = (Hash ^ (unsigned long long)(size_t)Frames[Index].Name) * 1099511628211ULL;
+                Hash = (Hash ^ Frames[Index].Line) * 1099511628211ULL;
+        }
+
+        for(unsigned int Probe = 0; Probe < LPROFILE_PROBES; Probe++)
+        {
+                struct lprofile_stack *Stack = &LprofileStacks[(Hash + Probe) & (LPROFILE_STACKS - 1)];
+                if(Stack->Samples == 0)
+                {
+                        if(LprofileFrameCount + Depth > LPROFILE_FRAMES) break;
+
+                        for(unsigned int Index = 0; Index < Depth; Index++)
+                        {
+                                LprofileFrames[LprofileFrameCount + Index] = Frames[Index];
+                        }
+                        Stack->Hash = Hash;
+                        Stack->First = LprofileFrameCount;
+                        Stack->Depth = Depth;
+                        Stack->Samples = 1;
+                        LprofileFrameCount += Depth;
+                        LprofileStackCount++;
+                        return;
+                }
+
+                if(Stack->Hash == Hash && Stack->Depth == Depth)
+                {
+                        lprofile_frame *Stored = &LprofileFrames[Stack->First];
+                        unsigned int Index = 0;
+                        while(Index < Depth && Stored[Index].Name == Frames[Index].Name &&
+                              Stored[Index].Line == Frames[Index].Line) Index++;
+                        if(Index == Depth)
+                        {
+                                Stack->Samples++;
+                                return;
+                        }
+                }
+        }
+        LprofileDropped++;
+}
+
+void
+LprofileSignalHandler(int Signal)
+{
+        /* Another thread is recording, or the tables are being written out. */
+        if(__atomic_exchange_n(&LprofileBusy, 1, __ATOMIC_ACQUIRE)) return;
+
+        LprofileSamples++;
+        if(LthreadIsWorker)
+        {
+                LprofileRecord(&LprofileWorkerFrame, 1);
+        }
+        else
+        {
+                unsigned int Depth = LprofileDepth;
+                __atomic_signal_fence(__ATOMIC_ACQUIRE);
+                if(Depth == 0) LprofileRecord(&LprofileIdleFrame, 1);
+                else LprofileRecord(LprofileShadow, GSMin(Depth, LPROFILE_DEPTH));
+        }
+
+        __atomic_store_n(&LprofileBusy, 0, __ATOMIC_RELEASE);
+}
+
+void
+LprofileLock(void)
+{
+        while(__atomic_exchange_n(&LprofileBusy, 1, __ATOMIC_ACQUIRE)) sched_yield();
+}
+
+void
+LprofileUnlock(void)
+{
+        __atomic_store_n(&LprofileBusy, 0, __ATOMIC_RELEASE);
+}
+
+void
+LprofileSetTimer(unsigned int Hertz)
+{
+        struct itimerval Timer = {0};
+        if(Hertz != 0)
+        {
+                unsigned int Period = GSMax(1000000 / Hertz, 1);
+                Timer.it_interval.tv_sec = Period / 1000000;
+                Timer.it_interval.tv_usec = Period % 1000000;
+                Timer.it_value = Timer.it_interval;
+        }
+        setitimer(ITIMER_PROF, &Timer, GSNullPtr);
+}
+
+/* Clears the counts and starts sampling. Main thread only. */
+void
+LprofileStart(void)
+{
+        LprofileSetTimer(0);
+
+        LprofileLock();
+        memset(LprofileStacks, 0, sizeof(LprofileStacks));
+        LprofileFrameCount = 0;
+        LprofileStackCount = 0;
+        LprofileSamples = 0;
+        LprofileDropped = 0;
+        LprofileDepth = 0;
+        LprofileUnlock();
+
+        struct sigaction Action = {0};
+        Action.sa_handler = LprofileSignalHandler;
+        sigemptyset(&Action.sa_mask);
+        Action.sa_flags = SA_RESTART;
+        sigaction(SIGPROF, &Action, GSNullPtr);
+
+        LprofileEnabled = true;
+        LprofileSetTimer(GSMax(LprofileHertz, 1));
+}
+
+void
+LprofileWriteFrame(FILE *File, lprofile_frame *Frame)
+{
+        fputs(Frame->Name, File);
+        if(Frame->Line != 0) fprintf(File, " (%s:%u)", LprofileSource, Frame->Line);
+}
+
+/* Stops sampling and writes the folded stacks. Returns false if they couldn't be written. */
+gs_bool
+LprofileStop(void)
+{
+        LprofileSetTimer(0);
+        LprofileEnabled = false;
+
+        FILE *File = fopen(LprofileFile, "w");
+        if(File == GSNullPtr) return(false);
+
+        LprofileLock();
+        for(unsigned int Index = 0; Index < LPROFILE_STACKS; Index++)
+        {
+                struct lprofile_stack *Stack = &LprofileStacks[Index];
+                if(Stack->Samples == 0) continue;
+
+                for(unsigned int Frame = 0; Frame < Stack->Depth; Frame++)
+                {
+                        if(Frame != 0) fputc(';', File);
+                        LprofileWriteFrame(File, &LprofileFrames[Stack->First + Frame]);
+                }
+                fprintf(File, " %llu\n", Stack->Samples);
+        }
+        LprofileUnlock();
+
+        gs_bool Result = !ferror(File);
+        Result &= (fclose(File) == 0);
+        return(Result);
+}
+
+void
+LprofilePrint(FILE *File)
+{
+        /* Callers check LprofileFile; programs from --emit-c never set it, which gcc can see. */
+        fprintf(File, "profile: %llu samples in %u stacks, %llu dropped, written to %s\n",
+                LprofileSamples, LprofileStackCount, LprofileDropped, LprofileFile ? LprofileFile : "nothing");
+}
+
+/******************************************************************************
+ * Reclaimer
+ *-----------------------------------------------------------------------------
+ * Started with --reclaim bytes. Results and ASTs whose printed size reaches
+ * the threshold are freed by a background thread, so the next prompt doesn't
+ * wait for millions of frees. Trees are passed through a single producer,
+ * single consumer ring. The thread parks on a semaphore when the ring is
+ * empty, and only a hand-off that finds it parked posts it.
+ *
+ * Back-pressure: each queued tree is weighed by its printed size. If the ring
+ * is full, or the weight still queued would pass --reclaim-max-pending, the
+ * caller frees the tree itself, so memory held by unreclaimed trees stays
+ * bounded when the reclaimer falls behind.
+ ******************************************************************************/
+
+enum lreclaim_kind_e
+{
+        LRECLAIM_KIND_LVAL,
+        LRECLAIM_KIND_AST
+};
+
+struct lreclaim_item
+{
+        void *Tree;
+        size_t Weight;
+        enum lreclaim_kind_e Kind;
+};
+
+#define LRECLAIM_CAPACITY 1024
+
+static struct lreclaim_item LreclaimQueue[LRECLAIM_CAPACITY];
+static unsigned long long LreclaimHead = 0;
+static unsigned long long LreclaimTail = 0;
+static size_t LreclaimPending = 0;
+
+static size_t LreclaimThreshold = 0;
+static size_t LreclaimMaxPending = 64 << 20;
+
+static pthread_t LreclaimThread;
+static sem_t LreclaimWake;
+static gs_bool LreclaimParked = false;
+static gs_bool LreclaimStopping = false;
+
+/*
+ * A release handed back from the reclaimer or another worker. Each gets its
+ * own node, since a tree can hold the same lambda more than once.
+ */
+struct lreclaim_deferred
+{
+        llambda *Lambda;
+        struct lreclaim_deferred *Next;
+};
+
+static struct lreclaim_deferred *LreclaimDeferred = GSNullPtr;
+
+static unsigned long long LreclaimQueued = 0;
+static unsigned long long LreclaimInline = 0;
+static unsigned long long LreclaimSmall = 0;
+
+void
+LreclaimDeferLambda(llambda *Self)
+{
+        struct lreclaim_deferred *Node = malloc(sizeof(struct lreclaim_deferred));
+        Node->Lambda = Self;
+
+        struct lreclaim_deferred *Head = __atomic_load_n(&LreclaimDeferred, __ATOMIC_RELAXED);
+        do Node->Next = Head;
+        while(!__atomic_compare_exchange_n(&LreclaimDeferred, &Head, Node, true,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Finishes lambda releases handed back by workers. Main thread only. */
+void
+LreclaimDrainDeferred(void)
+{
+        struct lreclaim_deferred *Node = __atomic_exchange_n(&LreclaimDeferred, GSNullPtr, __ATOMIC_ACQUIRE);
+        while(Node != GSNullPtr)
+        {
+                struct lreclaim_deferred *Next = Node->Next;
+                LlambdaRelease(Node->Lambda);
+                free(Node);
+                Node = Next;
+        }
+}
+
+void
+LreclaimFree(void *Tree, enum lreclaim_kind_e Kind)
+{
+        if(Kind == LRECLAIM_KIND_LVAL) LvalFree(Tree);
+        else mpc_ast_delete(Tree);
+}
+
+void *
+LreclaimMain(void *Argument)
+{
+        LthreadIsWorker = true;
+
+        while(true)
+        {
+                unsigned long long Head = LreclaimHead;
+                unsigned long long Tail = __atomic_load_n(&LreclaimTail, __ATOMIC_ACQUIRE);
+                for(; Head != Tail; Head++)
+                {
+                        struct lreclaim_item *Item = &LreclaimQueue[Head % LRECLAIM_CAPACITY];
+                        LreclaimFree(Item->Tree, Item->Kind);
+                        __atomic_sub_fetch(&LreclaimPending, Item->Weight, __ATOMIC_RELAXED);
+                        __atomic_store_n(&LreclaimHead, Head + 1, __ATOMIC_RELEASE);
+                }
+
+                if(__atomic_load_n(&LreclaimStopping, __ATOMIC_ACQUIRE) &&
+                   Head == __atomic_load_n(&LreclaimTail, __ATOMIC_ACQUIRE)) return(GSNullPtr);
+
+                /*
+                 * Park, then look again: a producer either sees the flag and posts, or
+                 * published before the flag was set and is seen here. If the flag was
+                 * already taken back, its post is pending, so the wait returns at once.
+                 */
+                __atomic_store_n(&LreclaimParked, true, __ATOMIC_SEQ_CST);
+                if(__atomic_load_n(&LreclaimTail, __ATOMIC_SEQ_CST) != Head ||
+                   __atomic_load_n(&LreclaimStopping, __ATOMIC_SEQ_CST))
+                {
+                        if(__atomic_exchange_n(&LreclaimParked, false, __ATOMIC_SEQ_CST)) continue;
+                }
+                sem_wait(&LreclaimWake);
+        }
+}
+
+void
+LreclaimStart(size_t Threshold)
+{
+        LreclaimThreshold = Threshold;
+        sem_init(&LreclaimWake, 0, 0);
+        if(pthread_create(&LreclaimThread, GSNullPtr, LreclaimMain, GSNullPtr) != 0)
+        {
+                fprintf(stderr, "Couldn't start the reclaimer, freeing inline\n");
+                LreclaimThreshold = 0;
+        }
+}
+
+/* Waits for everything queued to be freed. */
+void
+LreclaimStop(void)
+{
+        if(LreclaimThreshold != 0)
+        {
+                __atomic_store_n(&LreclaimStopping, true, __ATOMIC_SEQ_CST);
+                if(__atomic_exchange_n(&LreclaimParked, false, __ATOMIC_SEQ_CST)) sem_post(&LreclaimWake);
+                pthread_join(LreclaimThread, GSNullPtr);
+                sem_destroy(&LreclaimWake);
+                LreclaimThreshold = 0;
+        }
+        LreclaimDrainDeferred();
+}
+
+/* Frees Tree, on the reclaimer if Weight (its printed size) reaches the threshold. */
+void
+LreclaimTree(void *Tree, enum lreclaim_kind_e Kind, size_t Weight)
+{
+        if(LreclaimThreshold == 0 || Weight < LreclaimThreshold)
+        {
+                if(LreclaimThreshold != 0) LreclaimSmall++;
+                LreclaimFree(Tree, Kind);
+                return;
+        }
+
+        LreclaimDrainDeferred();
+
+        /* A tree heavier than the limit still goes when nothing else is waiting. */
+        unsigned long long Tail = LreclaimTail;
+        unsigned long long Head = __atomic_load_n(&LreclaimHead, __ATOMIC_ACQUIRE);
+        size_t Pending = __atomic_load_n(&LreclaimPending, __ATOMIC_RELAXED);
+        if(Tail - Head == LRECLAIM_CAPACITY || (Pending != 0 && Pending + Weight > LreclaimMaxPending))
+        {
+                LreclaimInline++;
+                LreclaimFree(Tree, Kind);
+                return;
+        }
+
+        struct lreclaim_item *Item = &LreclaimQueue[Tail % LRECLAIM_CAPACITY];
+        Item->Tree = Tree;
+        Item->Kind = Kind;
+        Item->Weight = Weight;
+        __atomic_add_fetch(&LreclaimPending, Weight, __ATOMIC_RELAXED);
+        __atomic_store_n(&LreclaimTail, Tail + 1, __ATOMIC_SEQ_CST);
+        LreclaimQueued++;
+        if(__atomic_exchange_n(&LreclaimParked, false, __ATOMIC_SEQ_CST)) sem_post(&LreclaimWake);
+}
+
+void
+LreclaimLval(lval *Self, size_t PrintedBytes)
+{
+        LreclaimTree(Self, LRECLAIM_KIND_LVAL, PrintedBytes);
+}
+
+void
+LreclaimAst(mpc_ast_t *Tree, size_t InputBytes)
+{
+        LreclaimTree(Tree, LRECLAIM_KIND_AST, InputBytes);
+}
+
+void
+LreclaimPrint(FILE *File)
+{
+        fprintf(File, "reclaim: %llu queued, %llu freed inline under back-pressure, %llu below threshold, "
+                "%zu bytes pending\n", LreclaimQueued, LreclaimInline, LreclaimSmall,
+                __atomic_load_n(&LreclaimPending, __ATOMIC_RELAXED));
+}
+
+lval *
+BuiltInReclaim(lenv *Env, lval *Self)
+{
+        LvalFree(Self);
+        if(LreclaimThreshold == 0) return(LvalError(LVAL_ERROR_NO_RECLAIM));
+        LreclaimPrint(stdout);
+        return(LvalSExpression());
+}
+
+lval *
+BuiltInProfileStart(lenv *Env, lval *Self)
+{
+        LvalFree(Self);
+        if(LprofileFile == GSNullPtr) return(LvalError(LVAL_ERROR_NO_PROFILE));
+        LprofileStart();
+        return(LvalSExpression());
+}
+
+lval *
+BuiltInProfileStop(lenv *Env, lval *Self)
+{
+        LvalFree(Self);
+        if(LprofileFile == GSNullPtr) return(LvalError(LVAL_ERROR_NO_PROFILE));
+        if(!LprofileStop()) return(LvalError(LVAL_ERROR_PROFILE_WRITE));
+        LprofilePrint(stdout);
+        return(LvalSExpression());
+}
+
+lval *
+BuiltInPerfCounters(lenv *Env, lval *Self)
+{
+        LvalFree(Self);
+        if(!LcounterEnabled) return(LvalError(LVAL_ERROR_NO_COUNTERS));
+        LcounterPrint(stdout);
+        return(LvalSExpression());
+}
+
+lval *
+BuiltInLatency(lenv *Env, lval *Self)
+{
+        LvalFree(Self);
+        if(!LhistogramEnabled) return(LvalError(LVAL_ERROR_NO_LATENCY));
+        LhistogramPrint(stdout);
+        return(LvalSExpression());
+}
+
+#define LBUILTIN_MAX 64
+
+static lbuiltin_info LbuiltinRegistry[LBUILTIN_MAX];
+static unsigned int LbuiltinCount = 0;
+
+/* Returns the registry entry for Function, creating it on first use. */
+lbuiltin_info *
+LbuiltinRegister(char *Name, lbuiltin Function, char *CName)
+{
+        for(int Index = 0; Index < LbuiltinCount; Index++)
+        {
+                if(LbuiltinRegistry[Index].Function == Function) return(&LbuiltinRegistry[Index]);
+        }
+
+        if(LbuiltinCount == LBUILTIN_MAX) GSAbortWithMessage("Too many builtins!\n");
+
+        lbuiltin_info *Result = &LbuiltinRegistry[LbuiltinCount++];
+        Result->Name = Name;
+        Result->Function = Function;
+        Result->CName = CName;
+        return(Result);
+}
+
+void
+LenvAddBuiltInNamed(lenv *Env, char *Name, lbuiltin Function, char *CName, gs_bool IsPure)
+{
+        lbuiltin_info *BuiltIn = LbuiltinRegister(Name, Function, CName);
+        if(IsPure) BuiltIn->IsPure = true;
+
+        lval *Key = LvalSymbol(Name);
+        lval *Value = LvalFunction(BuiltIn);
+        LenvPut(Env, Key, Value);
+        LvalFree(Key);
+        LvalFree(Value);
+}
+
+#define LenvAddBuiltIn(Env, Name, Function) LenvAddBuiltInNamed((Env), (Name), (Function), #Function, false)
+#define LenvAddPureBuiltIn(Env, Name, Function) LenvAddBuiltInNamed((Env), (Name), (Function), #Function, true)
+
+lval *BuiltInList(lenv *Env, lval *Value);
+lval *BuiltInHead(lenv *Env, lval *Value);
+lval *BuiltInTail(lenv *Env, lval *Value);
+lval *BuiltInEval(lenv *Env, lval *Value);
+lval *BuiltInJoin(lenv *Env, lval *Value);
+lval *BuiltInAdd(lenv *Env, lval *Value);
+lval *BuiltInSubtract(lenv *Env, lval *Value);
+lval *BuiltInMultiply(lenv *Env, lval *Value);
+lval *BuiltInDivide(lenv *Env, lval *Value);
+lval *BuiltInStats(lenv *Env, lval *Value);
+lval *BuiltInStatsReset(lenv *Env, lval *Value);
+lval *BuiltInMem(lenv *Env, lval *Value);
+lval *BuiltInTraceDump(lenv *Env, lval *Value);
+lval *BuiltInLambda(lenv *Env, lval *Value);
+lval *BuiltInDef(lenv *Env, lval *Value);
+lval *BuiltInMemo(lenv *Env, lval *Value);
+lval *BuiltInSave(lenv *Env, lval *Value);
+lval *BuiltInLoadBin(lenv *Env, lval *Value);
+lval *BuiltInReclaim(lenv *Env, lval *Value);
+lval *BuiltInJit(lenv *Env, lval *Value);
+lval *BuiltInProfileStart(lenv *Env, lval *Value);
+lval *BuiltInProfileStop(lenv *Env, lval *Value);
+lval *BuiltInPerfCounters(lenv *Env, lval *Value);
+lval *BuiltInLatency(lenv *Env, lval *Value);
+
+void
+LenvAddBuiltIns(lenv *Env)
+{
+        /* List Functions */
+        LenvAddPureBuiltIn(Env, "list", BuiltInList);
+        LenvAddPureBuiltIn(Env, "head", BuiltInHead);
+        LenvAddPureBuiltIn(Env, "tail", BuiltInTail);
+        LenvAddPureBuiltIn(Env, "eval", BuiltInEval);
+        LenvAddPureBuiltIn(Env, "join", BuiltInJoin);
+
+        /* Variable Functions */
+        LenvAddBuiltIn(Env, "\\", BuiltInLambda);
+        LenvAddBuiltIn(Env, "def", BuiltInDef);
+
+        /* File Functions */
+        LenvAddBuiltIn(Env, "save", BuiltInSave);
+        LenvAddBuiltIn(Env, "load-bin", BuiltInLoadBin);
+
+        /* Math Functions */
+        LenvAddPureBuiltIn(Env, "+", BuiltInAdd);
+        LenvAddPureBuiltIn(Env, "-", BuiltInSubtract);
+        LenvAddPureBuiltIn(Env, "*", BuiltInMultiply);
+        LenvAddPureBuiltIn(Env, "/", BuiltInDivide);
+
+        /* Introspection Functions */
+        LenvAddBuiltIn(Env, "stats", BuiltInStats);
+        LenvAddBuiltIn(Env, "stats-reset", BuiltInStatsReset);
+        LenvAddBuiltIn(Env, "mem", BuiltInMem);
+        LenvAddBuiltIn(Env, "trace-dump", BuiltInTraceDump);
+        LenvAddBuiltIn(Env, "memo", BuiltInMemo);
+        LenvAddBuiltIn(Env, "reclaim", BuiltInReclaim);
+        LenvAddBuiltIn(Env, "jit", BuiltInJit);
+        LenvAddBuiltIn(Env, "profile-start", BuiltInProfileStart);
+        LenvAddBuiltIn(Env, "profile-stop", BuiltInProfileStop);
+        LenvAddBuiltIn(Env, "perf-counters", BuiltInPerfCounters);
+        LenvAddBuiltIn(Env, "latency", BuiltInLatency);
+}
+
+/******************************************************************************
+ ******************************************************************************/
+
+lval *
+BuiltInOperator(lenv *Env, lval *Self, char *Operator)
+{
+        lval *Result = GSNullPtr;
+
+        for(int Cell = 0; Cell < Self->CellCount; Cell++)
+        {
+                if(Self->Cell[Cell]->Type != LVAL_TYPE_NUMBER)
+                {
+                        LvalFree(Self);
+                        Result = LvalError(LVAL_ERROR_NOT_A_NUMBER);
+                        return(Result);
+                }
+        }
+
+        Result = LvalPop(Self, 0);
+
+        if(GSStringIsEqual(Operator, "-", 1) && Self->CellCount == 0)
+        {
+                Result->Number = -(Result->Number);
+        }
+
+        while(Self->CellCount > 0)
+        {
+                lval *Foo = LvalPop(Self, 0);
+
+                if(GSStringIsEqual(Operator, "+", 1))
+                        Result->Number += Foo->Number;
+                if(GSStringIsEqual(Operator, "-", 1))
+                        Result->Number -= Foo->Number;
+                if(GSStringIsEqual(Operator, "*", 1))
+                        Result->Number *= Foo->Number;
+                if(GSStringIsEqual(Operator, "/", 1))
+                {
+                        if(Foo->Number == 0)
+                        {
+                                LvalFree(Result);
+                                LvalFree(Foo);
+                                Result = LvalError(LVAL_ERROR_DIV_ZERO);
+                                break;
+                        }
+                        Result->Number /= Foo->Number;
+                }
+
+                LvalFree(Foo);
+        }
+
+        LvalFree(Self);
+        return(Result);
+}
+
+lval *
+BuiltInAdd(lenv *Env, lval *Value)
+{
+        lval *Result = BuiltInOperator(Env, Value, "+");
+        return(Result);
+}
+
+lval *
+BuiltInSubtract(lenv *Env, lval *Value)
+{
+        lval *Result = BuiltInOperator(Env, Value, "-");
+        return(Result);
+}
+
+lval *
+BuiltInMultiply(lenv *Env, lval *Value)
+{
+        lval *Result = BuiltInOperator(Env, Value, "*");
+        return(Result);
+}
+
+lval *
+BuiltInDivide(lenv *Env, lval *Value)
+{
+        lval *Result = BuiltInOperator(Env, Value, "/");
+        return(Result);
+}
+
+lval *
+BuiltInHead(lenv *Env, lval *Self)
+{
+        LASSERT(Self, Self->CellCount == 1,
+                LVAL_ERROR_HEAD_ARGUMENTS);
+        LASSERT(Self, Self->Cell[0]->Type == LVAL_TYPE_QEXPRESSION,
+                LVAL_ERROR_HEAD_TYPE);
+        LASSERT(Self, Self->Cell[0]->CellCount != 0,
+                LVAL_ERROR_HEAD_EMPTY);
+
+        lval *Result = LvalTake(Self, 0);
+        while(Result->CellCount > 1)
+        {
+                LvalFree(LvalPop(Result, 1));
+        }
+
+        return(Result);
+}
+
+lval *
+BuiltInTail(lenv *Env, lval *Self)
+{
+        LASSERT(Self, Self->CellCount == 1,
+                LVAL_ERROR_TAIL_ARGUMENTS);
+        LASSERT(Self, Self->Cell[0]->Type == LVAL_TYPE_QEXPRESSION,
+                LVAL_ERROR_TAIL_TYPE);
+        LASSERT(Self, Self->Cell[0]->CellCount != 0,
+                LVAL_ERROR_TAIL_EMPTY);
+
+        lval *Result = LvalTake(Self, 0);
+        LvalFree(LvalPop(Result, 0));
+        return(Result);
+}
+
+lval *
+BuiltInList(lenv *Env, lval *Self)
+{
+        Self->Type = LVAL_TYPE_QEXPRESSION;
+        return(Self);
+}
+
+lval *LjitEval(lenv *Env, lval *Self);
+
+lval *
+BuiltInEval(lenv *Env, lval *Self)
+{
+        LASSERT(Self, Self->CellCount == 1,
+                LVAL_ERROR_EVAL_ARGUMENTS);
+        LASSERT(Self, Self->Cell[0]->Type == LVAL_TYPE_QEXPRESSION,
+                LVAL_ERROR_EVAL_TYPE);
+
+        lval *Result = LvalTake(Self, 0);
+        Result->Type = LVAL_TYPE_SEXPRESSION;
+        return(LjitEval(Env, Result));
+}
+
+lval *
+BuiltInLambda(lenv *Env, lval *Self)
+{
+        LASSERT(Self, Self->CellCount == 2,
+                LVAL_ERROR_LAMBDA_ARGUMENTS);
+        LASSERT(Self, Self->Cell[0]->Type == LVAL_TYPE_QEXPRESSION,
+                LVAL_ERROR_LAMBDA_ARGUMENTS);
+        LASSERT(Self, Self->Cell[1]->Type == LVAL_TYPE_QEXPRESSION,
+                LVAL_ERROR_LAMBDA_ARGUMENTS);
+        for(int Cell = 0; Cell < Self->Cell[0]->CellCount; Cell++)
+        {
+                LASSERT(Self, Self->Cell[0]->Cell[Cell]->Type == LVAL_TYPE_SYMBOL,
+                        LVAL_ERROR_LAMBDA_FORMALS);
+        }
+
+        lval *Formals = LvalPop(Self, 0);
+        lval *Body = LvalPop(Self, 0);
+        LvalFree(Self);
+        return(LvalLambda(Env, Formals, Body));
+}
+
+lval *
+BuiltInDef(lenv *Env, lval *Self)
+{
+        LASSERT(Self, Self->CellCount > 0 && Self->Cell[0]->Type == LVAL_TYPE_QEXPRESSION,
+                LVAL_ERROR_DEF_TYPE);
+
+        lval *Symbols = Self->Cell[0];
+        for(int Cell = 0; Cell < Symbols->CellCount; Cell++)
+        {
+                LASSERT(Self, Symbols->Cell[Cell]->Type == LVAL_TYPE_SYMBOL,
+                        LVAL_ERROR_DEF_TYPE);
+        }
+        LASSERT(Self, Symbols->CellCount == Self->CellCount - 1,
+                LVAL_ERROR_DEF_COUNT);
+
+        for(int Cell = 0; Cell < Symbols->CellCount; Cell++)
+        {
+                LenvDef(Env, Symbols->Cell[Cell], Self->Cell[Cell + 1]);
+        }
+
+        LvalFree(Self);
+        return(LvalSExpression());
+}
+
+lval *
+BuiltInJoin__(lval *Left, lval *Right)
+{
+        while(Right->CellCount)
+        {
+                Left = LvalAdd(Left, LvalPop(Right, 0));
+        }
+
+        LvalFree(Right);
+        return(Left);
+}
+
+lval *
+BuiltInJoin(lenv *Env, lval *Self)
+{
+        for(int Cell = 0; Cell < Self->CellCount; Cell++)
+        {
+                LASSERT(Self, Self->Cell[Cell]->Type == LVAL_TYPE_QEXPRESSION,
+                        LVAL_ERROR_JOIN_TYPE);
+        }
+
+        lval *Result = LvalPop(Self, 0);
+
+        while(Self->CellCount)
+        {
+                Result = BuiltInJoin__(Result, LvalPop(Self, 0));
+        }
+
+        LvalFree(Self);
+        return(Result);
+}
+
+/* Times are inclusive: eval's time includes the builtins it calls. */
+void
+BuiltInStatsPrint(FILE *File)
+{
+        double TicksPerNanosecond = ClockTicksPerNanosecond();
+
+        fprintf(File, "%-14s %12s %14s %14s %12s\n", "builtin", "calls", "cells", "total ms", "ns/call");
+        for(int Index = 0; Index < LbuiltinCount; Index++)
+        {
+                lbuiltin_info *Info = &LbuiltinRegistry[Index];
+                if(Info->Calls == 0) continue;
+
+                double Nanoseconds = Info->Ticks / TicksPerNanosecond;
+                fprintf(File, "%-14s %12llu %14llu %14.3f %12.1f\n",
+                        Info->Name, Info->Calls, Info->Cells,
+                        Nanoseconds / 1e6, Nanoseconds / Info->Calls);
+        }
+}
+
+/*
+ * Single-element S-Expressions evaluate to that element, so these, mem and
+ * trace-dump must be called with a (ignored) argument: stats {}
+ */
+lval *
+BuiltInStats(lenv *Env, lval *Self)
+{
+        LvalFree(Self);
+        BuiltInStatsPrint(stdout);
+        return(LvalSExpression());
+}
+
+lval *
+BuiltInStatsReset(lenv *Env, lval *Self)
+{
+        LvalFree(Self);
+        for(int Index = 0; Index < LbuiltinCount; Index++)
+        {
+                LbuiltinRegistry[Index].Calls = 0;
+                LbuiltinRegistry[Index].Cells = 0;
+                LbuiltinRegistry[Index].Ticks = 0;
+        }
+        return(LvalSExpression());
+}
+
+lval *
+BuiltInMem(lenv *Env, lval *Self)
+{
+        LvalFree(Self);
+#ifdef LISPY_ALLOC_STATS
+        LallocPrint(stdout);
+        return(LvalSExpression());
+#else
+        return(LvalError(LVAL_ERROR_NO_ALLOC_STATS));
+#endif
+}
+
+lval *
+BuiltInTraceDump(lenv *Env, lval *Self)
+{
+        LvalFree(Self);
+        if(!LtraceEnabled) return(LvalError(LVAL_ERROR_NO_TRACE));
+        if(!LtraceDump()) return(LvalError(LVAL_ERROR_TRACE_WRITE));
+        return(LvalSExpression());
+}
+
+lval *
+BuiltIn(lenv *Env, lval *Self, char *Function)
+{
+        if(GSStringIsEqual(Function, "list", 4)) return(BuiltInList(Env, Self));
+        if(GSStringIsEqual(Function, "head", 4)) return(BuiltInHead(Env, Self));
+        if(GSStringIsEqual(Function, "tail", 4)) return(BuiltInTail(Env, Self));
+        if(GSStringIsEqual(Function, "join", 4)) return(BuiltInJoin(Env, Self));
+        if(GSStringIsEqual(Function, "eval", 4)) return(BuiltInEval(Env, Self));
+        if(GSStringHasSubstring("+-/*", 4, Function, 1)) return(BuiltInOperator(Env, Self, Function));
+
+        LvalFree(Self);
+
+        lval *Result = LvalError(LVAL_ERROR_UNKNOWN_FUNCTION);
+        return(Result);
+}
+
+lval *
+LispEvalSExpression(lenv *Env, lval *Self)
+{
+        lval *Result = GSNullPtr;
+
+        /* Evaluation replaces the head, so the profiler takes its name now. */
+        lsymbol *Head = GSNullPtr;
+        if(__builtin_expect(LprofileEnabled, false) &&
+           Self->CellCount > 0 && Self->Cell[0]->Type == LVAL_TYPE_SYMBOL) Head = Self->Cell[0]->Symbol;
+
+        /* Evaluate all children. */
+        for(int Cell = 0; Cell < Self->CellCount; Cell++)
+        {
+                Self->Cell[Cell] = LispEval(Env, Self->Cell[Cell]);
+        }
+
+        /* Check for errors. */
+        for(int Cell = 0; Cell < Self->CellCount; Cell++)
+        {
+                if(Self->Cell[Cell]->Type == LVAL_TYPE_ERROR)
+                {
+                        Result = LvalTake(Self, Cell);
+                        return(Result);
+                }
+        }
+
+        /* Empty S-Expression. */
+        if(Self->CellCount == 0) return(Self);
+
+        /* Single element in S-Expression; ie., Single Expression. */
+        if(Self->CellCount == 1)
+        {
+                Result = LvalTake(Self, 0);
+                return(Result);
+        }
+
+        /* Ensure first element is a function. */
+        lval *FirstElement = LvalPop(Self, 0);
+        if(FirstElement->Type == LVAL_TYPE_LAMBDA)
+        {
+                LtraceEnter("lambda", Self->CellCount);
+                LprofileEnter(Head ? Head->Name : "lambda", Self->Line);
+                Result = LvalCall(FirstElement, Self);
+                LprofileExit();
+                LtraceExit("lambda");
+
+                LvalFree(FirstElement);
+                return(Result);
+        }
+        if(FirstElement->Type != LVAL_TYPE_FUNCTION)
+        {
+                LvalFree(Self);
+                LvalFree(FirstElement);
+                Result = LvalError(LVAL_ERROR_NOT_A_FUNCTION);
+                return(Result);
+        }
+
+        lbuiltin_info *BuiltIn = FirstElement->BuiltIn;
+        BuiltIn->Calls++;
+        BuiltIn->Cells += Self->CellCount;
+
+        LtraceEnter(BuiltIn->Name, Self->CellCount);
+        LprofileEnter(Head ? Head->Name : BuiltIn->Name, Self->Line);
+        unsigned long long Start = ClockTicks();
+        Result = BuiltIn->Function(Env, Self);
+        BuiltIn->Ticks += ClockTicks() - Start;
+        LprofileExit();
+        LtraceExit(BuiltIn->Name);
+
+        LvalFree(FirstElement);
+
+        /* A builtin can allocate past the ceiling without another reduction. */
+        if(__builtin_expect(LgovernorBytes > LgovernorByteCeiling, false))
+        {
+                LvalFree(Result);
+                Result = LvalError(LVAL_ERROR_MAX_BYTES);
+        }
+        return(Result);
+}
+
+lval *
+LispEval(lenv *Env, lval *Value)
+{
+        lval *Result = GSNullPtr;
+
+        if(__builtin_expect(LgovernorIsExhausted(), false))
+        {
+                LvalFree(Value);
+                Result = LvalError(LgovernorFuel == 0 ? LVAL_ERROR_FUEL : LVAL_ERROR_MAX_BYTES);
+                return(Result);
+        }
+        LgovernorFuel--;
+
+        if(Value->Type == LVAL_TYPE_SYMBOL)
+        {
+                Result = LenvGet(Env, Value);
+                LvalFree(Value);
+                return(Result);
+        }
+        else if(Value->Type == LVAL_TYPE_SEXPRESSION)
+        {
+                LtraceEnter("eval", Value->CellCount);
+                Result = LispEvalSExpression(Env, Value);
+                LtraceExit("eval");
+                return(Result);
+        }
+        /* TODO(AARON): Delete the following case? */
+        else
+        {
+                Result = Value;
+                return(Result);
+        }
+
+        return(Result);
+}
+
+/******************************************************************************
+ * Arithmetic Fast Path
+ *-----------------------------------------------------------------------------
+ * Most repl lines are sums and products of literals. Such a line is
+ * evaluated straight off the AST with unboxed longs, skipping LvalRead and
+ * the lvals LispEval would build and free. It qualifies when each
+ * S-Expression in it is either a single operand or an operator applied to
+ * operands, each operator is a symbol still bound to the + - * / builtins,
+ * and each operand is a number or another such S-Expression. Any other line,
+ * or one nested too deep, is read and interpreted as before.
+ *
+ * The result is the one LispEval gives: every operand is evaluated, the
+ * first error among them wins, and otherwise BuiltInOperator's rules apply.
+ * Builtin calls, cells and time are counted as usual. The governor, the
+ * tracer and the profiler account per reduction, so while any of them is on
+ * lines are interpreted.
+ ******************************************************************************/
+
+#define EVAL_MAX_DEPTH 64
+
+/* Returns the arithmetic builtin Tree is bound to, or null. */
+lval *
+EvalOperator(lenv *Env, mpc_ast_t *Tree)
+{
+        if(!GSStringHasSubstring(Tree->tag, 0, "symbol", 6)) return(GSNullPtr);
+
+        /* Only the operators' own spellings, so a lookup never interns a new name. */
+        char *Name = Tree->contents;
+        if(Name[0] == '\0' || Name[1] != '\0' || strchr("+-*/", Name[0]) == GSNullPtr) return(GSNullPtr);
+
+        lval *Value = LenvLookup(Env, LsymbolIntern(Name));
+        if(Value == GSNullPtr || Value->Type != LVAL_TYPE_FUNCTION) return(GSNullPtr);
+
+        lbuiltin Function = Value->BuiltIn->Function;
+        if(Function != BuiltInAdd && Function != BuiltInSubtract &&
+           Function != BuiltInMultiply && Function != BuiltInDivide) return(GSNullPtr);
+        return(Value);
+}
+
+/* Returns true if Eval can evaluate Tree, an S-Expression or the root of a line. */
+gs_bool
+EvalIsArithmetic(lenv *Env, mpc_ast_t *Tree, unsigned int Depth)
+{
+        if(GSStringHasSubstring(Tree->tag, 0, "number", 6)) return(true);
+        if(GSStringHasSubstring(Tree->tag, 0, "symbol", 6)) return(false);
+        if(GSStringHasSubstring(Tree->tag, 0, "qexpr", 5)) return(false);
+        if(Depth == EVAL_MAX_DEPTH) return(false);
+
+        unsigned int Count = 0;
+        gs_bool HasOperator = false;
+        for(int Index = 0; Index < Tree->children_num; Index++)
+        {
+                mpc_ast_t *Child = Tree->children[Index];
+                if(LvalReadIsPunctuation(Child)) continue;
+
+                if(Count == 0 && EvalOperator(Env, Child) != GSNullPtr) HasOperator = true;
+                else if(!EvalIsArithmetic(Env, Child, Depth + 1)) return(false);
+                Count++;
+        }
+
+        /* () and a lone operator evaluate to themselves; a head needs operands. */
+        if(HasOperator) return(Count > 1);
+        return(Count == 1);
+}
+
+/*
+ * Evaluates a tree EvalIsArithmetic accepted into Number, or returns its
+ * error. Ticks is set to the time the tree took. An operator is charged that
+ * time less its operands', as LispEvalSExpression charges a builtin call.
+ */
+lval *
+EvalTree(lenv *Env, mpc_ast_t *Tree, long *Number, unsigned long long *Ticks)
+{
+        *Ticks = 0;
+        if(GSStringHasSubstring(Tree->tag, 0, "number", 6))
+        {
+                return(mpc_strtol_dec(Tree->contents, Number) ? GSNullPtr : LvalError(LVAL_ERROR_BAD_NUMBER));
+        }
+
+        unsigned long long Start = ClockTicks();
+        unsigned long long OperandTicks = 0;
+        lval *Operator = GSNullPtr;
+        lval *OperandError = GSNullPtr;
+        lval *OperatorError = GSNullPtr;
+        unsigned int Count = 0;
+        long Result = 0;
+        for(int Index = 0; Index < Tree->children_num; Index++)
+        {
+                mpc_ast_t *Child = Tree->children[Index];
+                if(LvalReadIsPunctuation(Child)) continue;
+
+                if(Count == 0 && Operator == GSNullPtr)
+                {
+                        Operator = EvalOperator(Env, Child);
+                        if(Operator != GSNullPtr) continue;
+                }
+
+                long Operand;
+                unsigned long long Ticks;
+                lval *Error = EvalTree(Env, Child, &Operand, &Ticks);
+                OperandTicks += Ticks;
+                if(OperandError == GSNullPtr) OperandError = Error;
+                Count++;
+                if(OperandError != GSNullPtr || OperatorError != GSNullPtr) continue;
+
+                lbuiltin Function = Operator ? Operator->BuiltIn->Function : GSNullPtr;
+                if(Count == 1)                       Result = Operand;
+                else if(Function == BuiltInAdd)      Result += Operand;
+                else if(Function == BuiltInSubtract) Result -= Operand;
+                else if(Function == BuiltInMultiply) Result *= Operand;
+                else if(Operand == 0)                OperatorError = LvalError(LVAL_ERROR_DIV_ZERO);
+                else                                 Result /= Operand;
+        }
+
+        if(Count == 1 && Operator != GSNullPtr && Operator->BuiltIn->Function == BuiltInSubtract) Result = -Result;
+        *Ticks = ClockTicks() - Start;
+
+        if(OperandError != GSNullPtr) return(OperandError);
+        if(Operator != GSNullPtr)
+        {
+                Operator->BuiltIn->Calls++;
+                Operator->BuiltIn->Cells += Count;
+                Operator->BuiltIn->Ticks += *Ticks - OperandTicks;
+        }
+        if(OperatorError != GSNullPtr) return(OperatorError);
+
+        *Number = Result;
+        return(GSNullPtr);
+}
+
+/* Evaluates a line EvalIsArithmetic accepted. */
+lval *
+Eval(lenv *Env, mpc_ast_t *Tree)
+{
+        long Number;
+        unsigned long long Ticks;
+        lval *Error = EvalTree(Env, Tree, &Number, &Ticks);
+        return(Error ? Error : LvalNumber(Number));
+}
+
+/******************************************************************************
+ * Binary Serialization
+ *-----------------------------------------------------------------------------
+ * A compact encoding of lval trees for passing values between processes
+ * without printing and reparsing them:
+ *
+ *      "LSPB" version
+ *      symbol count, then each symbol as length and bytes
+ *      tree: a tag byte, then
+ *              number          zigzag varint
+ *              symbol          varint index into the symbol table
+ *              s/q-expression  varint cell count, then the cells
+ *              error           varint error code
+ *              function        varint index of the builtin's name
+ *
+ * All integers are LEB128 varints. Lambdas hold an environment and can't be
+ * written. load-bin maps the file and decodes straight from the mapping.
+ ******************************************************************************/
+
+#define LBLOB_MAGIC "LSPB"
+#define LBLOB_VERSION 1
+
+enum lblob_tag_e
+{
+        LBLOB_TAG_NUMBER,
+        LBLOB_TAG_SYMBOL,
+        LBLOB_TAG_SEXPRESSION,
+        LBLOB_TAG_QEXPRESSION,
+        LBLOB_TAG_ERROR,
+        LBLOB_TAG_FUNCTION
+};
+
+struct lblob_writer
+{
+        /* Symbols in table order, with room for one per slot. */
+        lsymbol **Symbols;
+        unsigned int SymbolCount;
+
+        /* Open addressing on the symbol's hash; ~0u marks an empty slot. */
+        unsigned int *Slots;
+        unsigned int SlotCount;
+};
+typedef struct lblob_writer lblob_writer;
+
+/* Returns Symbol's index in the symbol table, adding it if it's new. */
+unsigned int
+LblobSymbolIndex(lblob_writer *Self, lsymbol *Symbol)
+{
+        if(Self->SymbolCount * 2 >= Self->SlotCount)
+        {
+                unsigned int SlotCount = GSMax(Self->SlotCount * 2, 64);
+                unsigned int *Slots = LallocMalloc(LallocTag, sizeof(unsigned int) * SlotCount);
+                memset(Slots, 0xff, sizeof(unsigned int) * SlotCount);
+                for(unsigned int Index = 0; Index < Self->SymbolCount; Index++)
+                {
+                        unsigned int Slot = Self->Symbols[Index]->Hash & (SlotCount - 1);
+                        while(Slots[Slot] != ~0u) Slot = (Slot + 1) & (SlotCount - 1);
+                        Slots[Slot] = Index;
+                }
+                LallocFree(Self->Slots);
+                Self->Slots = Slots;
+                Self->SlotCount = SlotCount;
+                Self->Symbols = LallocRealloc(LallocTag, Self->Symbols, sizeof(lsymbol *) * SlotCount);
+        }
+
+        unsigned int Slot = Symbol->Hash & (Self->SlotCount - 1);
+        while(Self->Slots[Slot] != ~0u)
+        {
+                if(Self->Symbols[Self->Slots[Slot]] == Symbol) return(Self->Slots[Slot]);
+                Slot = (Slot + 1) & (Self->SlotCount - 1);
+        }
+
+        Self->Slots[Slot] = Self->SymbolCount;
+        Self->Symbols[Self->SymbolCount] = Symbol;
+        return(Self->SymbolCount++);
+}
+
+/* Expressions being encoded or decoded; Index is the next cell, Count the cells expected. */
+struct lblob_frame
+{
+        lval *Expression;
+        unsigned long long Index;
+        unsigned long long Count;
+};
+
+static __thread struct lblob_frame *LblobStack = GSNullPtr;
+static __thread unsigned int LblobStackCapacity = 0;
+
+/* Returns the frame at Depth, growing the stack if needed. */
+struct lblob_frame *
+LblobFrame(unsigned int Depth)
+{
+        if(Depth == LblobStackCapacity)
+        {
+                LblobStackCapacity = GSMax(LblobStackCapacity * 2, 64);
+                LblobStack = realloc(LblobStack, sizeof(struct lblob_frame) * LblobStackCapacity);
+        }
+        return(&LblobStack[Depth]);
+}
+
+/*
+ * Numbers every symbol in the tree. False if the tree holds a lambda. Like
+ * LblobWrite and LblobRead it keeps its own stack, so blob depth isn't
+ * bounded by the C stack.
+ */
+gs_bool
+LblobCollect(lblob_writer *Self, lval *Value)
+{
+        unsigned int Depth = 0;
+        while(true)
+        {
+                switch(Value->Type)
+                {
+                        case(LVAL_TYPE_SYMBOL):   LblobSymbolIndex(Self, Value->Symbol); break;
+                        case(LVAL_TYPE_FUNCTION): LblobSymbolIndex(Self, LsymbolIntern(Value->BuiltIn->Name)); break;
+                        case(LVAL_TYPE_LAMBDA):   return(false);
+                        case(LVAL_TYPE_SEXPRESSION):
+                        case(LVAL_TYPE_QEXPRESSION):
+                        {
+                                struct lblob_frame *Frame = LblobFrame(Depth++);
+                                Frame->Expression = Value;
+                                Frame->Index = 0;
+                        } break;
+                }
+
+                while(Depth > 0 && LblobStack[Depth - 1].Index == LblobStack[Depth - 1].Expression->CellCount)
+                {
+                        Depth--;
+                }
+                if(Depth == 0) return(true);
+
+                struct lblob_frame *Top = &LblobStack[Depth - 1];
+                Value = Top->Expression->Cell[Top->Index++];
+        }
+}
+
+void
+LblobWrite(lblob_writer *Self, lbuffer *Buffer, lval *Value)
+{
+        unsigned int Depth = 0;
+        while(true)
+        {
+                switch(Value->Type)
+                {
+                        case(LVAL_TYPE_NUMBER):
+                        {
+                                /* Zigzag, so small negative numbers stay short. */
+                                unsigned long long Number = (unsigned long long)Value->Number;
+                                LbufferPutChar(Buffer, LBLOB_TAG_NUMBER);
+                                LbufferPutVarint(Buffer, (Number << 1) ^ (0ULL - (Number >> 63)));
+                        } break;
+                        case(LVAL_TYPE_SYMBOL):
+                        {
+                                LbufferPutChar(Buffer, LBLOB_TAG_SYMBOL);
+                                LbufferPutVarint(Buffer, LblobSymbolIndex(Self, Value->Symbol));
+                        } break;
+                        case(LVAL_TYPE_ERROR):
+                        {
+                                LbufferPutChar(Buffer, LBLOB_TAG_ERROR);
+                                LbufferPutVarint(Buffer, Value->ErrorCode);
+                        } break;
+                        case(LVAL_TYPE_FUNCTION):
+                        {
+                                LbufferPutChar(Buffer, LBLOB_TAG_FUNCTION);
+                                LbufferPutVarint(Buffer, LblobSymbolIndex(Self, LsymbolIntern(Value->BuiltIn->Name)));
+                        } break;
+                        case(LVAL_TYPE_SEXPRESSION):
+                        case(LVAL_TYPE_QEXPRESSION):
+                        {
+                                LbufferPutChar(Buffer, (Value->Type == LVAL_TYPE_SEXPRESSION) ?
+                                                       LBLOB_TAG_SEXPRESSION : LBLOB_TAG_QEXPRESSION);
+                                LbufferPutVarint(Buffer, Value->CellCount);
+
+                                struct lblob_frame *Frame = LblobFrame(Depth++);
+                                Frame->Expression = Value;
+                                Frame->Index = 0;
+                        } break;
+                }
+
+                while(Depth > 0 && LblobStack[Depth - 1].Index == LblobStack[Depth - 1].Expression->CellCount)
+                {
+                        Depth--;
+                }
+                if(Depth == 0) return;
+
+                struct lblob_frame *Top = &LblobStack[Depth - 1];
+                Value = Top->Expression->Cell[Top->Index++];
+        }
+}
+
+/* Appends the encoding of Self to Buffer. False if Self holds a lambda. */
+gs_bool
+LvalSerialize(lval *Self, lbuffer *Buffer)
+{
+        lblob_writer Writer = { 0 };
+
+        gs_bool Result = LblobCollect(&Writer, Self);
+        if(Result)
+        {
+                LbufferPutBytes(Buffer, LBLOB_MAGIC, 4);
+                LbufferPutChar(Buffer, LBLOB_VERSION);
+                LbufferPutVarint(Buffer, Writer.SymbolCount);
+                for(int Index = 0; Index < Writer.SymbolCount; Index++)
+                {
+                        lsymbol *Symbol = Writer.Symbols[Index];
+                        unsigned int Length = GSStringLength(Symbol->Name);
+                        LbufferPutVarint(Buffer, Length);
+                        LbufferPutBytes(Buffer, Symbol->Name, Length);
+                }
+                LblobWrite(&Writer, Buffer, Self);
+        }
+
+        LallocFree(Writer.Symbols);
+        LallocFree(Writer.Slots);
+        return(Result);
+}
+
+struct lblob_reader
+{
+        unsigned char *At;
+        unsigned char *End;
+        lsymbol **Symbols;
+        unsigned long long SymbolCount;
+
+        /* Cells that open S/Q-Expressions still expect. */
+        unsigned long long Pending;
+};
+typedef struct lblob_reader lblob_reader;
+
+gs_bool
+LblobReadVarint(lblob_reader *Self, unsigned long long *Value)
+{
+        unsigned long long Result = 0;
+        for(int Shift = 0; Shift < 64 && Self->At < Self->End; Shift += 7)
+        {
+                unsigned char Byte = *Self->At++;
+                Result |= (unsigned long long)(Byte & 0x7f) << Shift;
+                if(!(Byte & 0x80))
+                {
+                        *Value = Result;
+                        return(true);
+                }
+        }
+        return(false);
+}
+
+lbuiltin_info *
+LblobFindBuiltIn(lsymbol *Name)
+{
+        for(int Index = 0; Index < LbuiltinCount; Index++)
+        {
+                if(LsymbolIntern(LbuiltinRegistry[Index].Name) == Name) return(&LbuiltinRegistry[Index]);
+        }
+        return(GSNullPtr);
+}
+
+/*
+ * Returns the next value, or null if the input is malformed. An S/Q-Expression
+ * comes back empty, with Count set to the cells that follow it.
+ */
+lval *
+LblobReadNode(lblob_reader *Self, unsigned long long *Count)
+{
+        *Count = 0;
+
+        unsigned long long Payload;
+        if(Self->At == Self->End) return(GSNullPtr);
+        unsigned char Tag = *Self->At++;
+        if(!LblobReadVarint(Self, &Payload)) return(GSNullPtr);
+
+        switch(Tag)
+        {
+                case(LBLOB_TAG_NUMBER):
+                {
+                        return(LvalNumber((long)((Payload >> 1) ^ (0ULL - (Payload & 1)))));
+                }
+                case(LBLOB_TAG_SYMBOL):
+                {
+                        if(Payload >= Self->SymbolCount) return(GSNullPtr);
+
+                        lval *Result = LallocMalloc(LallocTag, sizeof(lval));
+                        Result->Type = LVAL_TYPE_SYMBOL;
+                        Result->Symbol = Self->Symbols[Payload];
+                        return(Result);
+                }
+                case(LBLOB_TAG_ERROR):
+                {
+                        if(Payload >= LVAL_ERROR_COUNT) return(GSNullPtr);
+                        return(LvalError(Payload));
+                }
+                case(LBLOB_TAG_FUNCTION):
+                {
+                        if(Payload >= Self->SymbolCount) return(GSNullPtr);
+
+                        lbuiltin_info *BuiltIn = LblobFindBuiltIn(Self->Symbols[Payload]);
+                        if(BuiltIn == GSNullPtr) return(GSNullPtr);
+                        return(LvalFunction(BuiltIn));
+                }
+                case(LBLOB_TAG_SEXPRESSION):
+                case(LBLOB_TAG_QEXPRESSION):
+                {
+                        /*
+                         * Every cell takes at least two bytes, so the cells of all open
+                         * expressions together are bounded by the input. Payload can be
+                         * near 2^64, so nothing is added before comparing.
+                         */
+                        unsigned long long Limit = (Self->End - Self->At) / 2;
+                        if(Self->Pending > Limit || Payload > Limit - Self->Pending) return(GSNullPtr);
+                        if(Payload > UINT_MAX) return(GSNullPtr);
+
+                        lval *Result = (Tag == LBLOB_TAG_SEXPRESSION) ? LvalSExpression() : LvalQExpression();
+                        LvalReserveCells(Result, Payload);
+                        *Count = Payload;
+                        return(Result);
+                }
+        }
+
+        return(GSNullPtr);
+}
+
+/* Returns null if the input is malformed. */
+lval *
+LblobRead(lblob_reader *Self)
+{
+        lval *Result = GSNullPtr;
+        unsigned int Depth = 0;
+        while(true)
+        {
+                if(Depth > 0) Self->Pending--;
+
+                unsigned long long Count;
+                lval *Value = LblobReadNode(Self, &Count);
+                if(Value == GSNullPtr)
+                {
+                        /* Every value read so far hangs off Result. */
+                        if(Result != GSNullPtr) LvalFree(Result);
+                        return(GSNullPtr);
+                }
+
+                if(Depth == 0)
+                {
+                        Result = Value;
+                }
+                else
+                {
+                        lval *Parent = LblobStack[Depth - 1].Expression;
+                        Parent->Cell[Parent->CellCount++] = Value;
+                }
+
+                if(Count > 0)
+                {
+                        struct lblob_frame *Frame = LblobFrame(Depth++);
+                        Frame->Expression = Value;
+                        Frame->Count = Count;
+                        Self->Pending += Count;
+                }
+
+                while(Depth > 0 && LblobStack[Depth - 1].Expression->CellCount == LblobStack[Depth - 1].Count)
+                {
+                        Depth--;
+                }
+                if(Depth == 0) return(Result);
+        }
+}
+
+/* Decodes one tree that fills all of Size bytes, or returns an error value. */
+lval *
+LvalDeserialize(char *Start, size_t Size)
+{
+        lval *Result = GSNullPtr;
+        lblob_reader Reader = { (unsigned char *)Start, (unsigned char *)Start + Size, GSNullPtr, 0 };
+
+        if(Size < 5 || memcmp(Start, LBLOB_MAGIC, 4) != 0 || Start[4] != LBLOB_VERSION)
+        {
+                return(LvalError(LVAL_ERROR_BAD_BLOB));
+        }
+        Reader.At += 5;
+
+        /* Every symbol takes at least two bytes, which bounds the allocation. */
+        if(!LblobReadVarint(&Reader, &Reader.SymbolCount) ||
+           Reader.SymbolCount > (Reader.End - Reader.At) / 2)
+        {
+                return(LvalError(LVAL_ERROR_BAD_BLOB));
+        }
+
+        Reader.Symbols = LallocMalloc(LallocTag, sizeof(lsymbol *) * GSMax(Reader.SymbolCount, 1));
+        for(unsigned int Index = 0; Index < Reader.SymbolCount; Index++)
+        {
+                unsigned long long Length;
+                if(!LblobReadVarint(&Reader, &Length) || Length == 0 ||
+                   Length > Reader.End - Reader.At ||
+                   memchr(Reader.At, '\0', Length) != GSNullPtr)
+                {
+                        LallocFree(Reader.Symbols);
+                        return(LvalError(LVAL_ERROR_BAD_BLOB));
+                }
+                Reader.Symbols[Index] = LsymbolInternBytes((char *)Reader.At, Length);
+                Reader.At += Length;
+        }
+
+        Result = LblobRead(&Reader);
+        if(Result != GSNullPtr && Reader.At != Reader.End)
+        {
+                LvalFree(Result);
+                Result = GSNullPtr;
+        }
+        LallocFree(Reader.Symbols);
+
+        if(Result == GSNullPtr) Result = LvalError(LVAL_ERROR_BAD_BLOB);
+        return(Result);
+}
+
+/* Files are named by a Q-Expression holding one symbol: {path/to/file}. */
+char *
+LvalFileName(lval *Self)
+{
+        if(Self->Type != LVAL_TYPE_QEXPRESSION || Self->CellCount != 1) return(GSNullPtr);
+        if(Self->Cell[0]->Type != LVAL_TYPE_SYMBOL) return(GSNullPtr);
+        return(Self->Cell[0]->Symbol->Name);
+}
+
+lval *
+BuiltInSave(lenv *Env, lval *Self)
+{
+        LASSERT(Self, Self->CellCount == 2 && LvalFileName(Self->Cell[0]) != GSNullPtr,
+                LVAL_ERROR_SAVE_ARGUMENTS);
+
+        lbuffer Buffer = {0};
+        if(!LvalSerialize(Self->Cell[1], &Buffer))
+        {
+                free(Buffer.Start);
+                LvalFree(Self);
+                return(LvalError(LVAL_ERROR_SAVE_TYPE));
+        }
+
+        gs_bool Written = false;
+        int Fd = open(LvalFileName(Self->Cell[0]), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(Fd >= 0)
+        {
+                Written = LbufferFlushFd(&Buffer, Fd);
+                Written &= (close(Fd) == 0);
+        }
+        free(Buffer.Start);
+        LvalFree(Self);
+
+        if(!Written) return(LvalError(LVAL_ERROR_SAVE_WRITE));
+        return(LvalSExpression());
+}
+
+lval *
+BuiltInLoadBin(lenv *Env, lval *Self)
+{
+        LASSERT(Self, Self->CellCount == 1 && LvalFileName(Self->Cell[0]) != GSNullPtr,
+                LVAL_ERROR_LOAD_ARGUMENTS);
+
+        int Fd = open(LvalFileName(Self->Cell[0]), O_RDONLY);
+        LvalFree(Self);
+        if(Fd < 0) return(LvalError(LVAL_ERROR_LOAD_READ));
+
+        struct stat Stat;
+        if(fstat(Fd, &Stat) != 0)
+        {
+                close(Fd);
+                return(LvalError(LVAL_ERROR_LOAD_READ));
+        }
+        if(Stat.st_size == 0)
+        {
+                close(Fd);
+                return(LvalError(LVAL_ERROR_BAD_BLOB));
+        }
+
+        char *Mapping = mmap(GSNullPtr, Stat.st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+        close(Fd);
+        if(Mapping == MAP_FAILED) return(LvalError(LVAL_ERROR_LOAD_READ));
+
+        lval *Result = LvalDeserialize(Mapping, Stat.st_size);
+        munmap(Mapping, Stat.st_size);
+        return(Result);
+}
+
+/******************************************************************************
+ * Memoization
+ *-----------------------------------------------------------------------------
+ * Opt-in cache of top level results, enabled with --memo bytes. Entries are
+ * keyed by a structural hash of the read expression plus the version of the
+ * global environment it was evaluated in, and the expression is compared in
+ * full on a hit. Only expressions whose symbols are all bound to numbers or
+ * pure builtins are cached. Rebinding any global changes the version, so older
+ * entries stop matching and age out of the LRU list.
+ ******************************************************************************/
+
+typedef struct lmemo_entry lmemo_entry;
+struct lmemo_entry
+{
+        lmemo_entry *Next;
+        lmemo_entry *Newer;
+        lmemo_entry *Older;
+
+        unsigned long long Hash;
+        unsigned long long Version;
+        size_t Bytes;
+
+        lval *Key;
+        lval *Value;
+};
+
+#define LMEMO_BUCKETS 4096
+
+static lmemo_entry *LmemoBuckets[LMEMO_BUCKETS];
+static lmemo_entry *LmemoNewest = GSNullPtr;
+static lmemo_entry *LmemoOldest = GSNullPtr;
+static size_t LmemoBytes = 0;
+static size_t LmemoLimit = 0;
+static unsigned int LmemoCount = 0;
+
+static unsigned long long LmemoHits = 0;
+static unsigned long long LmemoMisses = 0;
+static unsigned long long LmemoSkips = 0;
+static unsigned long long LmemoEvictions = 0;
+
+unsigned long long
+LmemoHash(lval *Self, unsigned long long Hash)
+{
+        Hash = (Hash ^ Self->Type) * 1099511628211ULL;
+        switch(Self->Type)
+        {
+                case(LVAL_TYPE_ERROR):  Hash = (Hash ^ Self->ErrorCode) * 1099511628211ULL; break;
+                case(LVAL_TYPE_NUMBER): Hash = (Hash ^ (unsigned long long)Self->Number) * 1099511628211ULL; break;
+                case(LVAL_TYPE_SYMBOL): Hash = (Hash ^ Self->Symbol->Hash) * 1099511628211ULL; break;
+                case(LVAL_TYPE_SEXPRESSION):
+                case(LVAL_TYPE_QEXPRESSION):
+                {
+                        Hash = (Hash ^ Self->CellCount) * 1099511628211ULL;
+                        for(int Index = 0; Index < Self->CellCount; Index++)
+                        {
+                                Hash = LmemoHash(Self->Cell[Index], Hash);
+                        }
+                } break;
+        }
+        return(Hash);
+}
+
+/* Looks in Env only; the memo is only used with the global environment. */
+gs_bool
+LmemoIsPure(lenv *Env, lval *Self)
+{
+        switch(Self->Type)
+        {
+                case(LVAL_TYPE_ERROR):
+                case(LVAL_TYPE_NUMBER):   return(true);
+                case(LVAL_TYPE_FUNCTION): return(Self->BuiltIn->IsPure);
+                case(LVAL_TYPE_LAMBDA):   return(false);
+                case(LVAL_TYPE_SYMBOL):
+                {
+                        lval *Value = LenvFind(Env->Snapshot, Self->Symbol);
+                        return(Value != GSNullPtr &&
+                               (Value->Type == LVAL_TYPE_NUMBER ||
+                                (Value->Type == LVAL_TYPE_FUNCTION && Value->BuiltIn->IsPure)));
+                }
+                case(LVAL_TYPE_SEXPRESSION):
+                case(LVAL_TYPE_QEXPRESSION):
+                {
+                        for(int Index = 0; Index < Self->CellCount; Index++)
+                        {
+                                if(!LmemoIsPure(Env, Self->Cell[Index])) return(false);
+                        }
+                        return(true);
+                }
+        }
+        return(false);
+}
+
+size_t
+LmemoSize(lval *Self)
+{
+        if(Self->Type == LVAL_TYPE_ERROR) return(0);
+
+        size_t Result = sizeof(lval);
+        if(Self->Type == LVAL_TYPE_SEXPRESSION || Self->Type == LVAL_TYPE_QEXPRESSION)
+        {
+                Result += LvalCellCapacity(Self) * sizeof(lval *);
+                for(int Index = 0; Index < Self->CellCount; Index++)
+                {
+                        Result += LmemoSize(Self->Cell[Index]);
+                }
+        }
+        return(Result);
+}
+
+/* Cached trees are charged to the memo, not to whoever triggered the miss. */
+lval *
+LmemoCopy(lval *Self)
+{
+        LallocTagPush(LALLOC_TAG_MEMO);
+        lval *Result = LvalCopy(Self);
+        LallocTagPop();
+        return(Result);
+}
+
+void
+LmemoUnlink(lmemo_entry *Entry)
+{
+        if(Entry->Newer) Entry->Newer->Older = Entry->Older;
+        else LmemoNewest = Entry->Older;
+        if(Entry->Older) Entry->Older->Newer = Entry->Newer;
+        else LmemoOldest = Entry->Newer;
+}
+
+void
+LmemoPushNewest(lmemo_entry *Entry)
+{
+        Entry->Newer = GSNullPtr;
+        Entry->Older = LmemoNewest;
+        if(LmemoNewest) LmemoNewest->Newer = Entry;
+        else LmemoOldest = Entry;
+        LmemoNewest = Entry;
+}
+
+void
+LmemoRemove(lmemo_entry *Entry)
+{
+        lmemo_entry **Link = &LmemoBuckets[Entry->Hash % LMEMO_BUCKETS];
+        while(*Link != Entry) Link = &(*Link)->Next;
+        *Link = Entry->Next;
+
+        LmemoUnlink(Entry);
+        LmemoBytes -= Entry->Bytes;
+        LmemoCount--;
+
+        LvalFree(Entry->Key);
+        LvalFree(Entry->Value);
+        LallocFree(Entry);
+}
+
+void
+LmemoClear(void)
+{
+        while(LmemoOldest != GSNullPtr) LmemoRemove(LmemoOldest);
+}
+
+lval *
+LmemoEval(lenv *Env, lval *Self)
+{
+        if(LmemoLimit == 0) return(LispEval(Env, Self));
+        if(!LmemoIsPure(Env, Self))
+        {
+                LmemoSkips++;
+                return(LispEval(Env, Self));
+        }
+
+        unsigned long long Hash = LmemoHash(Self, 14695981039346656037ULL);
+        lmemo_entry *Entry = LmemoBuckets[Hash % LMEMO_BUCKETS];
+        while(Entry != GSNullPtr)
+        {
+                lmemo_entry *Next = Entry->Next;
+                if(Entry->Hash == Hash && LvalIsEqual(Entry->Key, Self))
+                {
+                        if(Entry->Version == Env->Snapshot->Version)
+                        {
+                                LmemoHits++;
+                                LmemoUnlink(Entry);
+                                LmemoPushNewest(Entry);
+                                LvalFree(Self);
+                                return(LvalCopy(Entry->Value));
+                        }
+
+                        /* Evaluated before a rebinding; this call replaces it. */
+                        LmemoRemove(Entry);
+                }
+                Entry = Next;
+        }
+        LmemoMisses++;
+
+        lval *Key = LmemoCopy(Self);
+        lval *Result = LispEval(Env, Self);
+
+        size_t Bytes = sizeof(lmemo_entry) + LmemoSize(Key) + LmemoSize(Result);
+        if(Bytes > LmemoLimit || LgovernorIsExhausted())
+        {
+                LvalFree(Key);
+                return(Result);
+        }
+        while(LmemoBytes + Bytes > LmemoLimit)
+        {
+                LmemoEvictions++;
+                LmemoRemove(LmemoOldest);
+        }
+
+        Entry = LallocMalloc(LALLOC_TAG_MEMO, sizeof(lmemo_entry));
+        Entry->Hash = Hash;
+        Entry->Version = Env->Snapshot->Version;
+        Entry->Bytes = Bytes;
+        Entry->Key = Key;
+        Entry->Value = LmemoCopy(Result);
+
+        Entry->Next = LmemoBuckets[Hash % LMEMO_BUCKETS];
+        LmemoBuckets[Hash % LMEMO_BUCKETS] = Entry;
+        LmemoPushNewest(Entry);
+        LmemoBytes += Bytes;
+        LmemoCount++;
+
+        return(Result);
+}
+
+void
+LmemoPrint(FILE *File)
+{
+        unsigned long long Lookups = LmemoHits + LmemoMisses;
+        fprintf(File, "memo: %llu hits, %llu misses (%.1f%% hit rate), %llu uncacheable, %llu evictions\n",
+                LmemoHits, LmemoMisses, Lookups ? 100.0 * LmemoHits / Lookups : 0.0,
+                LmemoSkips, LmemoEvictions);
+        fprintf(File, "memo: %u entries, %zu of %zu bytes\n", LmemoCount, LmemoBytes, LmemoLimit);
+}
+
+lval *
+BuiltInMemo(lenv *Env, lval *Self)
+{
+        LvalFree(Self);
+        if(LmemoLimit == 0) return(LvalError(LVAL_ERROR_NO_MEMO));
+        LmemoPrint(stdout);
+        return(LvalSExpression());
+}
+
+/******************************************************************************
+ * JIT
+ *-----------------------------------------------------------------------------
+ * Opt-in with --jit threshold. Lambda bodies and expressions passed to eval
+ * count their runs, and once one has run threshold times it is compiled to
+ * x86-64 if it is a tree of + - * / over numbers and symbols. The code keeps
+ * intermediate values in registers and on the stack instead of boxing them,
+ * and bails out on overflow or division by zero, in which case the
+ * expression is interpreted as before. Anything else stays interpreted.
+ *
+ * def can rebind any name, so each run looks its symbols up again. The code
+ * only runs if its operands are still numbers and its heads are still the
+ * arithmetic builtins; their values are passed in an array. Code lives in
+ * mmap'd chunks that are never writable and executable at the same time, and
+ * is only freed at exit.
+ ******************************************************************************/
+
+#define LJIT_MAX_DEPTH 32
+#define LJIT_MAX_NODES 256
+#define LJIT_MAX_CODE 16384
+#define LJIT_MAX_BAILS (LJIT_MAX_NODES * 2)
+#define LJIT_CHUNK_SIZE (1 << 20)
+#define LJIT_MAX_CHUNKS 16
+#define LJIT_SLOTS 1024
+
+#define LJIT_RAX 0
+#define LJIT_RCX 1
+
+enum ljit_operator_e
+{
+        LJIT_OPERATOR_NONE,
+        LJIT_OPERATOR_ADD,
+        LJIT_OPERATOR_SUBTRACT,
+        LJIT_OPERATOR_MULTIPLY,
+        LJIT_OPERATOR_DIVIDE
+};
+typedef enum ljit_operator_e ljit_operator;
+
+struct ljit_input
+{
+        lsymbol *Symbol;
+
+        /* Heads must still be bound to this builtin, operands (null) to a number. */
+        lbuiltin Operator;
+};
+
+/* Returns 0 with the value in Result, or 1 to bail out. */
+typedef int (*ljit_function)(long *Inputs, long *Result);
+
+typedef struct ljit_code ljit_code;
+struct ljit_code
+{
+        ljit_function Function;
+
+        /* Reductions the interpreter would have made, charged as fuel. */
+        unsigned int NodeCount;
+
+        unsigned int InputCount;
+        struct ljit_input Inputs[];
+};
+
+/* eval'd expressions are counted in a direct-mapped table keyed like the memo. */
+struct ljit_slot
+{
+        unsigned long long Hash;
+        lval *Key;
+        unsigned int Count;
+        gs_bool Failed;
+        ljit_code *Code;
+};
+
+static unsigned int LjitThreshold = 0;
+static struct ljit_slot LjitSlots[LJIT_SLOTS];
+
+static unsigned char *LjitChunks[LJIT_MAX_CHUNKS];
+static unsigned int LjitChunkCount = 0;
+static size_t LjitChunkUsed = LJIT_CHUNK_SIZE;
+
+static unsigned long long LjitCompiled = 0;
+static unsigned long long LjitRejected = 0;
+static unsigned long long LjitRuns = 0;
+static unsigned long long LjitFallbacks = 0;
+static size_t LjitCodeBytes = 0;
+
+void
+LjitCodeFree(ljit_code *Self)
+{
+        if(Self != GSNullPtr) LallocFree(Self);
+}
+
+/* Copies Code into executable memory, or returns null once the chunks are used up. */
+void *
+LjitInstall(unsigned char *Code, size_t Size)
+{
+        size_t Aligned = (Size + 15) & ~(size_t)15;
+        if(LjitChunkUsed + Aligned > LJIT_CHUNK_SIZE)
+        {
+                if(LjitChunkCount == LJIT_MAX_CHUNKS) return(GSNullPtr);
+                void *Chunk = mmap(GSNullPtr, LJIT_CHUNK_SIZE, PROT_READ,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if(Chunk == MAP_FAILED) return(GSNullPtr);
+                LjitChunks[LjitChunkCount++] = Chunk;
+                LjitChunkUsed = 0;
+        }
+
+        unsigned char *Chunk = LjitChunks[LjitChunkCount - 1];
+        unsigned char *Result = Chunk + LjitChunkUsed;
+        if(mprotect(Chunk, LJIT_CHUNK_SIZE, PROT_READ | PROT_WRITE) != 0) return(GSNullPtr);
+        memcpy(Result, Code, Size);
+        if(mprotect(Chunk, LJIT_CHUNK_SIZE, PROT_READ | PROT_EXEC) != 0) return(GSNullPtr);
+        __builtin___clear_cache((char *)Result, (char *)Result + Size);
+
+        LjitChunkUsed += Aligned;
+        LjitCodeBytes += Aligned;
+        return(Result);
+}
+
+/*
+ * True if Self is headed by a symbol and its arguments are numbers, symbols
+ * or S-Expressions like it, within the depth and node limits. The type of
+ * Self itself isn't checked, since lambda bodies are Q-Expressions.
+ */
+gs_bool
+LjitIsCandidate(lval *Self, unsigned int Depth, unsigned int *NodeCount)
+{
+        if(Depth == LJIT_MAX_DEPTH || Self->CellCount < 2 ||
+           Self->Cell[0]->Type != LVAL_TYPE_SYMBOL) return(false);
+
+        *NodeCount += 2;
+        for(int Index = 1; Index < Self->CellCount; Index++)
+        {
+                lval *Cell = Self->Cell[Index];
+                if(Cell->Type == LVAL_TYPE_NUMBER || Cell->Type == LVAL_TYPE_SYMBOL)
+                {
+                        (*NodeCount)++;
+                }
+                else if(Cell->Type != LVAL_TYPE_SEXPRESSION ||
+                        !LjitIsCandidate(Cell, Depth + 1, NodeCount))
+                {
+                        return(false);
+                }
+                if(*NodeCount > LJIT_MAX_NODES) return(false);
+        }
+        return(true);
+}
+
+ljit_operator
+LjitOperator(lbuiltin Function)
+{
+        if(Function == BuiltInAdd)      return(LJIT_OPERATOR_ADD);
+        if(Function == BuiltInSubtract) return(LJIT_OPERATOR_SUBTRACT);
+        if(Function == BuiltInMultiply) return(LJIT_OPERATOR_MULTIPLY);
+        if(Function == BuiltInDivide)   return(LJIT_OPERATOR_DIVIDE);
+        return(LJIT_OPERATOR_NONE);
+}
+
+struct ljit_emitter
+{
+        lenv *Env;
+
+        unsigned char Code[LJIT_MAX_CODE];
+        unsigned int Size;
+
+        /* Offsets of the rel32 fields of jumps to the bail out path. */
+        unsigned int Bails[LJIT_MAX_BAILS];
+        unsigned int BailCount;
+
+        struct ljit_input Inputs[LJIT_MAX_NODES];
+        unsigned int InputCount;
+        unsigned int NodeCount;
+};
+typedef struct ljit_emitter ljit_emitter;
+
+/* Past the end is only counted, and the code is rejected once it's complete. */
+void
+LjitBytes(ljit_emitter *Emit, char *Bytes, unsigned int Count)
+{
+        for(unsigned int Index = 0; Index < Count; Index++)
+        {
+                if(Emit->Size < LJIT_MAX_CODE) Emit->Code[Emit->Size] = Bytes[Index];
+                Emit->Size++;
+        }
+}
+
+void
+LjitWord(ljit_emitter *Emit, unsigned long long Value, unsigned int Count)
+{
+        for(unsigned int Index = 0; Index < Count; Index++)
+        {
+                char Byte = (char)(Value >> (8 * Index));
+                LjitBytes(Emit, &Byte, 1);
+        }
+}
+
+/* Emits a conditional jump, 0F Condition rel32, patched to the bail out path later. */
+void
+LjitBail(ljit_emitter *Emit, char Condition)
+{
+        char Opcode[2] = { 0x0F, Condition };
+        LjitBytes(Emit, Opcode, 2);
+        if(Emit->BailCount < LJIT_MAX_BAILS) Emit->Bails[Emit->BailCount] = Emit->Size;
+        Emit->BailCount++;
+        LjitWord(Emit, 0, 4);
+}
+
+/*
+ * Returns Symbol's index in the inputs, adding it if it's new, or -1 if it
+ * isn't bound to a number, or for a head, to an arithmetic builtin.
+ */
+int
+LjitInput(ljit_emitter *Emit, lsymbol *Symbol, gs_bool IsHead)
+{
+        lval *Value = LenvLookup(Emit->Env, Symbol);
+        if(Value == GSNullPtr) return(-1);
+
+        lbuiltin Operator = GSNullPtr;
+        if(IsHead)
+        {
+                if(Value->Type != LVAL_TYPE_FUNCTION ||
+                   LjitOperator(Value->BuiltIn->Function) == LJIT_OPERATOR_NONE) return(-1);
+                Operator = Value->BuiltIn->Function;
+        }
+        else if(Value->Type != LVAL_TYPE_NUMBER)
+        {
+                return(-1);
+        }
+
+        for(unsigned int Index = 0; Index < Emit->InputCount; Index++)
+        {
+                if(Emit->Inputs[Index].Symbol == Symbol && Emit->Inputs[Index].Operator == Operator)
+                {
+                        return(Index);
+                }
+        }
+        Emit->Inputs[Emit->InputCount].Symbol = Symbol;
+        Emit->Inputs[Emit->InputCount].Operator = Operator;
+        return(Emit->InputCount++);
+}
+
+/* Loads a number or symbol into rax or rcx. */
+gs_bool
+LjitEmitOperand(ljit_emitter *Emit, lval *Self, int Register)
+{
+        Emit->NodeCount++;
+        if(Self->Type == LVAL_TYPE_NUMBER)
+        {
+                char Opcode[2] = { 0x48, 0xB8 + Register };     /* mov reg, imm64 */
+                LjitBytes(Emit, Opcode, 2);
+                LjitWord(Emit, Self->Number, 8);
+                return(true);
+        }
+
+        int Input = LjitInput(Emit, Self->Symbol, false);
+        if(Input < 0) return(false);
+        char Opcode[3] = { 0x48, 0x8B, 0x87 | (Register << 3) };  /* mov reg, [rdi + disp32] */
+        LjitBytes(Emit, Opcode, 3);
+        LjitWord(Emit, Input * sizeof(long), 4);
+        return(true);
+}
+
+/* Leaves the value of Self in rax. */
+gs_bool
+LjitEmitExpression(ljit_emitter *Emit, lval *Self)
+{
+        Emit->NodeCount += 2;
+        int Head = LjitInput(Emit, Self->Cell[0]->Symbol, true);
+        if(Head < 0) return(false);
+        ljit_operator Operator = LjitOperator(Emit->Inputs[Head].Operator);
+
+        lval *First = Self->Cell[1];
+        if(First->Type == LVAL_TYPE_SEXPRESSION)
+        {
+                if(!LjitEmitExpression(Emit, First)) return(false);
+        }
+        else if(!LjitEmitOperand(Emit, First, LJIT_RAX))
+        {
+                return(false);
+        }
+
+        if(Self->CellCount == 2 && Operator == LJIT_OPERATOR_SUBTRACT)
+        {
+                LjitBytes(Emit, "\x48\xF7\xD8", 3);                     /* neg rax */
+                LjitBail(Emit, 0x80);                                   /* jo bail */
+        }
+
+        for(int Index = 2; Index < Self->CellCount; Index++)
+        {
+                lval *Cell = Self->Cell[Index];
+                if(Cell->Type == LVAL_TYPE_SEXPRESSION)
+                {
+                        LjitBytes(Emit, "\x50", 1);                     /* push rax */
+                        if(!LjitEmitExpression(Emit, Cell)) return(false);
+                        LjitBytes(Emit, "\x48\x89\xC1\x58", 4);         /* mov rcx, rax; pop rax */
+                }
+                else if(!LjitEmitOperand(Emit, Cell, LJIT_RCX))
+                {
+                        return(false);
+                }
+
+                switch(Operator)
+                {
+                        case(LJIT_OPERATOR_ADD):      LjitBytes(Emit, "\x48\x01\xC8", 3); break;     /* add rax, rcx */
+                        case(LJIT_OPERATOR_SUBTRACT): LjitBytes(Emit, "\x48\x29\xC8", 3); break;     /* sub rax, rcx */
+                        case(LJIT_OPERATOR_MULTIPLY): LjitBytes(Emit, "\x48\x0F\xAF\xC1", 4); break; /* imul rax, rcx */
+                        case(LJIT_OPERATOR_DIVIDE):
+                        {
+                                LjitBytes(Emit, "\x48\x85\xC9", 3);             /* test rcx, rcx */
+                                LjitBail(Emit, 0x84);                           /* jz bail */
+                                LjitBytes(Emit, "\x48\x83\xF9\xFF\x75\x0B", 6); /* cmp rcx, -1; jne divide */
+                                LjitBytes(Emit, "\x48\xF7\xD8", 3);             /* neg rax */
+                                LjitBail(Emit, 0x80);                           /* jo bail */
+                                LjitBytes(Emit, "\xEB\x05", 2);                 /* jmp done */
+                                LjitBytes(Emit, "\x48\x99\x48\xF7\xF9", 5);     /* divide: cqo; idiv rcx */
+                                continue;                                       /* done: */
+                        }
+                        case(LJIT_OPERATOR_NONE): return(false);
+                }
+                LjitBail(Emit, 0x80);                                   /* jo bail */
+        }
+        return(true);
+}
+
+/* Returns null if Self can't be compiled. Main thread only. */
+ljit_code *
+LjitCompile(lenv *Env, lval *Self)
+{
+        unsigned int NodeCount = 0;
+        if(!LjitIsCandidate(Self, 0, &NodeCount))
+        {
+                LjitRejected++;
+                return(GSNullPtr);
+        }
+
+#if !defined(__x86_64__)
+        /* Only x86-64 code is generated; elsewhere everything stays interpreted. */
+        LjitRejected++;
+        return(GSNullPtr);
+#else
+        ljit_emitter *Emit = malloc(sizeof(ljit_emitter));
+        Emit->Env = Env;
+        Emit->Size = 0;
+        Emit->BailCount = 0;
+        Emit->InputCount = 0;
+        Emit->NodeCount = 0;
+
+        /* Inputs in rdi, Result in rsi. */
+        LjitBytes(Emit, "\x55\x48\x89\xE5", 4);                         /* push rbp; mov rbp, rsp */
+        gs_bool IsCompiled = LjitEmitExpression(Emit, Self);
+        LjitBytes(Emit, "\x48\x89\x06\x31\xC0\x5D\xC3", 7);             /* mov [rsi], rax; xor eax, eax; pop rbp; ret */
+        unsigned int Bail = Emit->Size;
+        LjitBytes(Emit, "\x48\x89\xEC\x5D\xB8\x01\x00\x00\x00\xC3", 10); /* bail: mov rsp, rbp; pop rbp; mov eax, 1; ret */
+
+        ljit_code *Result = GSNullPtr;
+        if(IsCompiled && Emit->Size <= LJIT_MAX_CODE && Emit->BailCount <= LJIT_MAX_BAILS)
+        {
+                for(unsigned int Index = 0; Index < Emit->BailCount; Index++)
+                {
+                        int Offset = Bail - (Emit->Bails[Index] + 4);
+                        memcpy(Emit->Code + Emit->Bails[Index], &Offset, sizeof(Offset));
+                }
+
+                void *Function = LjitInstall(Emit->Code, Emit->Size);
+                if(Function != GSNullPtr)
+                {
+                        Result = LallocMalloc(LallocTag, sizeof(ljit_code) + sizeof(struct ljit_input) * Emit->InputCount);
+                        Result->Function = (ljit_function)Function;
+                        Result->NodeCount = Emit->NodeCount;
+                        Result->InputCount = Emit->InputCount;
+                        memcpy(Result->Inputs, Emit->Inputs, sizeof(struct ljit_input) * Emit->InputCount);
+                }
+        }
+        free(Emit);
+
+        if(Result != GSNullPtr) LjitCompiled++;
+        else LjitRejected++;
+        return(Result);
+#endif
+}
+
+/* Returns false if Code's guards fail in Env or it bails out; Number is untouched then. */
+gs_bool
+LjitRun(ljit_code *Code, lenv *Env, long *Number)
+{
+        /* Running short is left to the interpreter, which stops at the right reduction. */
+        if(LgovernorIsExhausted() || LgovernorFuel < Code->NodeCount)
+        {
+                LjitFallbacks++;
+                return(false);
+        }
+
+        long Inputs[LJIT_MAX_NODES];
+        for(unsigned int Index = 0; Index < Code->InputCount; Index++)
+        {
+                struct ljit_input *Input = &Code->Inputs[Index];
+                lval *Value = LenvLookup(Env, Input->Symbol);
+                gs_bool IsBound;
+                if(Input->Operator != GSNullPtr)
+                {
+                        IsBound = Value != GSNullPtr && Value->Type == LVAL_TYPE_FUNCTION &&
+                                  Value->BuiltIn->Function == Input->Operator;
+                }
+                else
+                {
+                        IsBound = Value != GSNullPtr && Value->Type == LVAL_TYPE_NUMBER;
+                        if(IsBound) Inputs[Index] = Value->Number;
+                }
+
+                if(!IsBound)
+                {
+                        LjitFallbacks++;
+                        return(false);
+                }
+        }
+
+        if(Code->Function(Inputs, Number) != 0)
+        {
+                LjitFallbacks++;
+                return(false);
+        }
+        LgovernorFuel -= Code->NodeCount;
+        LjitRuns++;
+        return(true);
+}
+
+/* Traced runs stay interpreted, so every reduction shows up in the trace. */
+gs_bool
+LjitIsEnabled(void)
+{
+        return(LjitThreshold != 0 && !LthreadIsWorker && !LtraceEnabled);
+}
+
+/* Called by LvalCall with the filled frame, before the body is copied. */
+gs_bool
+LjitRunLambda(llambda *Lambda, lenv *Frame, long *Number)
+{
+        if(!LjitIsEnabled()) return(false);
+
+        if(Lambda->Jit == GSNullPtr)
+        {
+                if(Lambda->JitFailed || ++Lambda->Calls < LjitThreshold) return(false);
+                Lambda->Jit = LjitCompile(Frame, Lambda->Body);
+                if(Lambda->Jit == GSNullPtr)
+                {
+                        Lambda->JitFailed = true;
+                        return(false);
+                }
+        }
+        return(LjitRun(Lambda->Jit, Frame, Number));
+}
+
+void
+LjitSlotClear(struct ljit_slot *Slot)
+{
+        if(Slot->Key != GSNullPtr) LvalFree(Slot->Key);
+        LjitCodeFree(Slot->Code);
+        memset(Slot, 0, sizeof(*Slot));
+}
+
+/* Evaluates an S-Expression for eval, natively once it's hot. */
+lval *
+LjitEval(lenv *Env, lval *Self)
+{
+        unsigned int NodeCount = 0;
+        if(!LjitIsEnabled() || !LjitIsCandidate(Self, 0, &NodeCount))
+        {
+                return(LispEval(Env, Self));
+        }
+
+        unsigned long long Hash = LmemoHash(Self, 14695981039346656037ULL);
+        struct ljit_slot *Slot = &LjitSlots[Hash % LJIT_SLOTS];
+        if(Slot->Key == GSNullPtr || Slot->Hash != Hash || !LvalIsEqual(Slot->Key, Self))
+        {
+                LjitSlotClear(Slot);
+                Slot->Hash = Hash;
+                Slot->Key = LvalCopy(Self);
+        }
+
+        if(Slot->Code == GSNullPtr && !Slot->Failed && ++Slot->Count >= LjitThreshold)
+        {
+                Slot->Code = LjitCompile(Env, Self);
+                Slot->Failed = (Slot->Code == GSNullPtr);
+        }
+
+        long Number;
+        if(Slot->Code != GSNullPtr && LjitRun(Slot->Code, Env, &Number))
+        {
+                LvalFree(Self);
+                return(LvalNumber(Number));
+        }
+        return(LispEval(Env, Self));
+}
+
+/* Frees the eval table and unmaps the code. Compiled lambdas must be gone first. */
+void
+LjitClear(void)
+{
+        for(int Index = 0; Index < LJIT_SLOTS; Index++) LjitSlotClear(&LjitSlots[Index]);
+        for(unsigned int Index = 0; Index < LjitChunkCount; Index++)
+        {
+                munmap(LjitChunks[Index], LJIT_CHUNK_SIZE);
+        }
+        LjitChunkCount = 0;
+        LjitChunkUsed = LJIT_CHUNK_SIZE;
+}
+
+void
+LjitPrint(FILE *File)
+{
+        fprintf(File, "jit: %llu compiled, %llu not compilable, %zu bytes of code\n",
+                LjitCompiled, LjitRejected, LjitCodeBytes);
+        fprintf(File, "jit: %llu native runs, %llu fell back to the interpreter\n",
+                LjitRuns, LjitFallbacks);
+}
+
+lval *
+BuiltInJit(lenv *Env, lval *Self)
+{
+        LvalFree(Self);
+        if(LjitThreshold == 0) return(LvalError(LVAL_ERROR_NO_JIT));
+        LjitPrint(stdout);
+        return(LvalSExpression());
+}
+
+/******************************************************************************
+ * Benchmarks
+ *-----------------------------------------------------------------------------
+ * Generated workloads timed phase by phase: mpc_parse, LvalRead, LispEval,
+ * LvalCopy of the result, LvalPrint (rendered, not written out) and freeing
+ * the result, its copy and the AST. Workloads with a builder skip mpc_parse,
+ * which recurses per nesting level, and build the AST it would produce.
+ * Results are written to stdout as JSON so runs can be compared by tooling.
+ *
+ * Usage: lispy grammar.mpc --bench all --size 10000 --repeat 20 --warmup 3
+ ******************************************************************************/
+
+enum lbench_phase_e
+{
+        LBENCH_PHASE_PARSE,
+        LBENCH_PHASE_READ,
+        LBENCH_PHASE_EVAL,
+        LBENCH_PHASE_COPY,
+        LBENCH_PHASE_PRINT,
+        LBENCH_PHASE_FREE,
+        LBENCH_PHASE_COUNT
+};
+
+static char *LbenchPhaseNames[LBENCH_PHASE_COUNT] = { "parse", "read", "eval", "copy", "print", "free" };
+
+/* Writes the program text for a workload and adds any bindings it needs. */
+typedef void (*lbench_generator)(lbuffer *Source, lenv *Env, unsigned int Size);
+
+/* Builds the AST mpc_parse would produce, for inputs too deep for mpc's recursion. */
+typedef mpc_ast_t *(*lbench_builder)(unsigned int Size);
+
+struct lbench_workload
+{
+        char *Name;
+        char *Description;
+        lbench_generator Generate;
+        lbench_builder Build;
+};
+
+/* (+ 1 (+ 1 (+ 1 ... 0))) nested Size deep. */
+void
+BenchGenerateNesting(lbuffer *Source, lenv *Env, unsigned int Size)
+{
+        for(unsigned int Index = 0; Index < Size; Index++) LbufferPutString(Source, "(+ 1 ");
+        LbufferPutChar(Source, '0');
+        for(unsigned int Index = 0; Index < Size; Index++) LbufferPutChar(Source, ')');
+}
+
+/* (+ 0 1 2 ... Size-1): one call with Size arguments. */
+void
+BenchGenerateWide(lbuffer *Source, lenv *Env, unsigned int Size)
+{
+        LbufferPutString(Source, "(+");
+        for(unsigned int Index = 0; Index < Size; Index++)
+        {
+                LbufferPutChar(Source, ' ');
+                LbufferPutNumber(Source, Index);
+        }
+        LbufferPutChar(Source, ')');
+}
+
+/* (head (tail (tail ... (join {..} {..} ...)))) over Size elements in chunks of 64. */
+void
+BenchGenerateQExpression(lbuffer *Source, lenv *Env, unsigned int Size)
+{
+        unsigned int Tails = GSMin(Size / 2, 256);
+
+        LbufferPutString(Source, "(head ");
+        for(unsigned int Index = 0; Index < Tails; Index++) LbufferPutString(Source, "(tail ");
+
+        LbufferPutString(Source, "(join");
+        for(unsigned int Index = 0; Index < Size; Index++)
+        {
+                if(Index % 64 == 0) LbufferPutString(Source, Index ? "} {" : " {");
+                else LbufferPutChar(Source, ' ');
+                LbufferPutNumber(Source, Index);
+        }
+        LbufferPutString(Source, Size ? "})" : ")");
+
+        for(unsigned int Index = 0; Index < Tails; Index++) LbufferPutChar(Source, ')');
+        LbufferPutChar(Source, ')');
+}
+
+/*
+ * Binds Size symbols and sums 1024 of them, spread across the environment.
+ * Names are fixed width so every lookup has to compare the whole name.
+ */
+void
+BenchGenerateSymbols(lbuffer *Source, lenv *Env, unsigned int Size)
+{
+        char Name[32];
+        unsigned int Count = GSMax(Size, 1);
+
+        for(unsigned int Index = 0; Index < Count; Index++)
+        {
+                snprintf(Name, sizeof(Name), "sym%08u", Index);
+                lval *Key = LvalSymbol(Name);
+                lval *Value = LvalNumber(Index);
+                LenvPut(Env, Key, Value);
+                LvalFree(Key);
+                LvalFree(Value);
+        }
+
+        LbufferPutString(Source, "(+");
+        for(unsigned int Index = 0; Index < 1024; Index++)
+        {
+                snprintf(Name, sizeof(Name), " sym%08u", (unsigned int)((Index * 2654435761UL) % Count));
+                LbufferPutString(Source, Name);
+        }
+        LbufferPutChar(Source, ')');
+}
+
+/* {..} of Size numbers in nested groups of 16: evaluates to itself, so printing dominates. */
+void
+BenchGeneratePrint(lbuffer *Source, lenv *Env, unsigned int Size)
+{
+        LbufferPutChar(Source, '{');
+        for(unsigned int Index = 0; Index < Size; Index++)
+        {
+                if(Index % 16 == 0) LbufferPutString(Source, Index ? "} {" : "{");
+                else LbufferPutChar(Source, ' ');
+                LbufferPutNumber(Source, ((long)Index * 2654435761L) % 2000000001L - 1000000000L);
+        }
+        LbufferPutString(Source, Size ? "}}" : "}");
+}
+
+/* (list (head {}) ...) size times: every call fails argument validation. */
+void
+BenchGenerateErrors(lbuffer *Source, lenv *Env, unsigned int Size)
+{
+        LbufferPutString(Source, "(list");
+        for(unsigned int Index = 0; Index < Size; Index++) LbufferPutString(Source, " (head {})");
+        LbufferPutChar(Source, ')');
+}
+
+/* The same calls as errors, but every one passes validation. */
+void
+BenchGenerateChecks(lbuffer *Source, lenv *Env, unsigned int Size)
+{
+        LbufferPutString(Source, "(list");
+        for(unsigned int Index = 0; Index < Size; Index++) LbufferPutString(Source, " (head {0})");
+        LbufferPutChar(Source, ')');
+}
+
+/* (list (inc 0) (inc 1) ...) with inc bound to (\ {x} {+ x 1}): lambda call overhead. */
+void
+BenchGenerateCalls(lbuffer *Source, lenv *Env, unsigned int Size)
+{
+        lval *Formals = LvalAdd(LvalQExpression(), LvalSymbol("x"));
+        lval *Body = LvalQExpression();
+        LvalAdd(Body, LvalSymbol("+"));
+        LvalAdd(Body, LvalSymbol("x"));
+        LvalAdd(Body, LvalNumber(1));
+
+        lval *Key = LvalSymbol("inc");
+        lval *Value = LvalLambda(Env, Formals, Body);
+        LenvPut(Env, Key, Value);
+        LvalFree(Key);
+        LvalFree(Value);
+
+        LbufferPutString(Source, "(list");
+        for(unsigned int Index = 0; Index < Size; Index++)
+        {
+                LbufferPutString(Source, " (inc ");
+                LbufferPutNumber(Source, Index);
+                LbufferPutChar(Source, ')');
+        }
+        LbufferPutChar(Source, ')');
+}
+
+/* {{{...{}...}}} nested Size deep. */
+void
+BenchGenerateDeep(lbuffer *Source, lenv *Env, unsigned int Size)
+{
+        for(unsigned int Index = 0; Index < Size; Index++) LbufferPutChar(Source, '{');
+        for(unsigned int Index = 0; Index < Size; Index++) LbufferPutChar(Source, '}');
+}
+
+/* {0 1 2 ... Size-1}. */
+void
+BenchGenerateFlat(lbuffer *Source, lenv *Env, unsigned int Size)
+{
+        LbufferPutChar(Source, '{');
+        for(unsigned int Index = 0; Index < Size; Index++)
+        {
+                if(Index) LbufferPutChar(Source, ' ');
+                LbufferPutNumber(Source, Index);
+        }
+        LbufferPutChar(Source, '}');
+}
+
+mpc_ast_t *
+BenchBuildRoot(mpc_ast_t *Expression)
+{
+        mpc_ast_t *Result = mpc_ast_new(">", "");
+        mpc_ast_add_child(Result, mpc_ast_new("regex", ""));
+        mpc_ast_add_child(Result, Expression);
+        mpc_ast_add_child(Result, mpc_ast_new("regex", ""));
+        return(Result);
+}
+
+mpc_ast_t *
+BenchBuildDeep(unsigned int Size)
+{
+        mpc_ast_t *Result = GSNullPtr;
+        for(unsigned int Index = 0; Index < Size; Index++)
+        {
+                mpc_ast_t *Outer = mpc_ast_new("expr|qexpr|>", "");
+                mpc_ast_add_child(Outer, mpc_ast_new("char", "{"));
+                if(Result != GSNullPtr) mpc_ast_add_child(Outer, Result);
+                mpc_ast_add_child(Outer, mpc_ast_new("char", "}"));
+                Result = Outer;
+        }
+        return(BenchBuildRoot(Result ? Result : mpc_ast_new("regex", "")));
+}
+
+mpc_ast_t *
+BenchBuildFlat(unsigned int Size)
+{
+        char Number[24];
+        mpc_ast_t *Result = mpc_ast_new("expr|qexpr|>", "");
+        mpc_ast_add_child(Result, mpc_ast_new("char", "{"));
+        for(unsigned int Index = 0; Index < Size; Index++)
+        {
+                snprintf(Number, sizeof(Number), "%u", Index);
+                mpc_ast_add_child(Result, mpc_ast_new("expr|number|regex", Number));
+        }
+        mpc_ast_add_child(Result, mpc_ast_new("char", "}"));
+        return(BenchBuildRoot(Result));
+}
+
+static struct lbench_workload LbenchWorkloads[] =
+{
+        { "nesting", "(+ 1 (+ 1 ...)) nested size deep",           BenchGenerateNesting },
+        { "wide",    "(+ 0 1 ... size-1)",                           BenchGenerateWide },
+        { "qexpr",   "head/tail chain over join of size elements",   BenchGenerateQExpression },
+        { "symbols", "1024 lookups in an environment of size names", BenchGenerateSymbols },
+        { "print",   "q-expression of size numbers, print heavy",    BenchGeneratePrint },
+        { "errors",  "size calls of (head {}), all failing",         BenchGenerateErrors },
+        { "checks",  "size calls of (head {0}), all succeeding",     BenchGenerateChecks },
+        { "calls",   "size calls of a one-parameter lambda",         BenchGenerateCalls },
+        { "deep",    "q-expression nested size deep, AST built",     BenchGenerateDeep, BenchBuildDeep },
+        { "flat",    "q-expression of size numbers, AST built",      BenchGenerateFlat, BenchBuildFlat },
+};
+
+int
+BenchCompareTimes(const void *Left, const void *Right)
+{
+        unsigned long long A = *(unsigned long long *)Left;
+        unsigned long long B = *(unsigned long long *)Right;
+        return((A > B) - (A < B));
+}
+
+void
+BenchRun(struct lbench_workload *Workload, mpc_parser_t *Lispy,
+         unsigned int Size, unsigned int Repeat, unsigned int Warmup, int IsFirst)
+{
+        lenv *Env = LenvNew();
+        LenvAddBuiltIns(Env);
+
+        lbuffer Source = { 0 };
+        Workload->Generate(&Source, Env, Size);
+        LbufferPutChar(&Source, '\0');
+
+        lbuffer Output = { 0 };
+        size_t OutputBytes = 0;
+        unsigned long long *Times = calloc((size_t)LBENCH_PHASE_COUNT * GSMax(Repeat, 1),
+                                           sizeof(unsigned long long));
+        mpc_result_t MpcResult;
+
+        for(unsigned int Run = 0; Run < Warmup + Repeat; Run++)
+        {
+                unsigned long long Phase[LBENCH_PHASE_COUNT + 1];
+
+                Phase[LBENCH_PHASE_PARSE] = ClockNanoseconds();
+                if(Workload->Build != GSNullPtr)
+                {
+                        MpcResult.output = Workload->Build(Size);
+                }
+                else if(!mpc_parse("<bench>", Source.Start, Lispy, &MpcResult))
+                {
+                        mpc_err_print_to(MpcResult.error, stderr);
+                        mpc_err_delete(MpcResult.error);
+                        exit(EXIT_FAILURE);
+                }
+
+                Phase[LBENCH_PHASE_READ] = ClockNanoseconds();
+                LallocSetTag(LALLOC_TAG_READER);
+                lval *Result = LvalRead(MpcResult.output);
+
+                Phase[LBENCH_PHASE_EVAL] = ClockNanoseconds();
+                LallocSetTag(LALLOC_TAG_EVALUATOR);
+                Result = LispEval(Env, Result);
+
+                Phase[LBENCH_PHASE_COPY] = ClockNanoseconds();
+                lval *Copy = LvalCopy(Result);
+
+                Phase[LBENCH_PHASE_PRINT] = ClockNanoseconds();
+                Output.Length = 0;
+                LvalRender(&Output, Result);
+                OutputBytes = Output.Length;
+
+                Phase[LBENCH_PHASE_FREE] = ClockNanoseconds();
+                LvalFree(Copy);
+                LvalFree(Result);
+                mpc_ast_delete(MpcResult.output);
+
+                Phase[LBENCH_PHASE_COUNT] = ClockNanoseconds();
+
+                if(Run < Warmup) continue;
+                for(int Index = 0; Index < LBENCH_PHASE_COUNT; Index++)
+                {
+                        Times[Index * Repeat + (Run - Warmup)] = Phase[Index + 1] - Phase[Index];
+                }
+        }
+
+        printf("%s\n    {\"name\": \"%s\", \"description\": \"%s\", \"size\": %u, "
+               "\"repeat\": %u, \"warmup\": %u, \"input_bytes\": %zu, \"output_bytes\": %zu,\n"
+               "     \"phases\": {",
+               IsFirst ? "" : ",", Workload->Name, Workload->Description, Size,
+               Repeat, Warmup, Source.Length - 1, OutputBytes);
+
+        for(int Index = 0; Index < LBENCH_PHASE_COUNT && Repeat > 0; Index++)
+        {
+                unsigned long long *Samples = Times + Index * Repeat;
+                unsigned long long Total = 0;
+                for(unsigned int Run = 0; Run < Repeat; Run++) Total += Samples[Run];
+                qsort(Samples, Repeat, sizeof(unsigned long long), BenchCompareTimes);
+
+                printf("%s\n        \"%s\": {\"min_ns\": %llu, \"median_ns\": %llu, "
+                       "\"mean_ns\": %llu, \"max_ns\": %llu}",
+                       Index ? "," : "", LbenchPhaseNames[Index], Samples[0],
+                       Samples[Repeat / 2], Total / Repeat, Samples[Repeat - 1]);
+        }
+        printf("}}");
+
+        free(Times);
+        free(Output.Start);
+        free(Source.Start);
+        LenvFree(Env);
+}
+
+/* Names is "all" or a comma separated list of workload names. */
+gs_bool
+BenchIsWanted(char *Names, char *Name)
+{
+        if(GSStringIsEqual(Names, "all", 4)) return(true);
+
+        unsigned int NameLength = GSStringLength(Name);
+        for(char *Cursor = Names; *Cursor != GSNullChar; )
+        {
+                if(GSStringIsEqual(Cursor, Name, NameLength) &&
+                   (Cursor[NameLength] == ',' || Cursor[NameLength] == GSNullChar))
+                {
+                        return(true);
+                }
+                while(*Cursor != ',' && *Cursor != GSNullChar) Cursor++;
+                if(*Cursor == ',') Cursor++;
+        }
+
+        return(false);
+}
+
+void
+Bench(char *Names, mpc_parser_t *Lispy, unsigned int Size, unsigned int Repeat, unsigned int Warmup)
+{
+        int Wanted = 0;
+        for(int Index = 0; Index < GSArraySize(LbenchWorkloads); Index++)
+        {
+                Wanted += BenchIsWanted(Names, LbenchWorkloads[Index].Name);
+        }
+
+        if(!Wanted)
+        {
+                fprintf(stderr, "No workload matches '%s'. Available:", Names);
+                for(int Index = 0; Index < GSArraySize(LbenchWorkloads); Index++)
+                {
+                        fprintf(stderr, " %s", LbenchWorkloads[Index].Name);
+                }
+                fprintf(stderr, "\n");
+                exit(EXIT_FAILURE);
+        }
+
+        int Ran = 0;
+        printf("{\"size\": %u, \"repeat\": %u, \"warmup\": %u, \"workloads\": [", Size, Repeat, Warmup);
+        for(int Index = 0; Index < GSArraySize(LbenchWorkloads); Index++)
+        {
+                if(!BenchIsWanted(Names, LbenchWorkloads[Index].Name)) continue;
+                BenchRun(&LbenchWorkloads[Index], Lispy, Size, Repeat, Warmup, !Ran);
+                fflush(stdout);
+                Ran++;
+        }
+        LenvFramePoolFree();
+        printf("\n]}\n");
+}
+
+/*
+ * --bench-lookups: reader threads look up globals while the main thread keeps
+ * rebinding one of them, publishing a new snapshot each time.
+ */
+#define LBENCH_LOOKUPS (1 << 20)
+
+struct lbench_reader
+{
+        pthread_t Thread;
+        lenv *Env;
+        lval **Keys;
+        unsigned int KeyCount;
+        unsigned int Seed;
+
+        /* Each thread records its own and they're merged after the run. */
+        lhistogram Latency;
+};
+
+/* Timing every lookup would cost about as much as the lookup, so only every 16th is timed. */
+#define LBENCH_LOOKUP_SAMPLE 16
+
+static unsigned int LbenchReadersRunning = 0;
+
+void *
+BenchLookupsReader(void *Argument)
+{
+        struct lbench_reader *Reader = Argument;
+        LthreadIsWorker = true;
+
+        unsigned int Seed = Reader->Seed;
+        for(unsigned int Index = 0; Index < LBENCH_LOOKUPS; Index++)
+        {
+                Seed = Seed * 1103515245u + 12345u;
+                gs_bool IsTimed = (Index % LBENCH_LOOKUP_SAMPLE == 0);
+                unsigned long long Start = IsTimed ? ClockTicks() : 0;
+
+                lval *Value = LenvGet(Reader->Env, Reader->Keys[(Seed >> 8) % Reader->KeyCount]);
+                if(IsTimed) LhistogramRecord(&Reader->Latency, ClockTicks() - Start);
+
+                if(Value->Type != LVAL_TYPE_NUMBER) GSAbortWithMessage("Lookup failed!\n");
+                LvalFree(Value);
+        }
+
+        LepochRelease();
+        __atomic_sub_fetch(&LbenchReadersRunning, 1, __ATOMIC_RELEASE);
+        return(GSNullPtr);
+}
+
+/* Runs with 1, 2, 4 ... up to Threads readers. */
+void
+BenchLookups(unsigned int Threads, unsigned int Size, unsigned int Repeat)
+{
+        unsigned int Count = GSMax(Size, 1);
+        char Name[32];
+
+        lenv *Env = LenvNew();
+        lval **Keys = malloc(sizeof(lval *) * Count);
+        for(unsigned int Index = 0; Index < Count; Index++)
+        {
+                snprintf(Name, sizeof(Name), "sym%08u", Index);
+                Keys[Index] = LvalSymbol(Name);
+                lval *Value = LvalNumber(Index);
+                LenvPut(Env, Keys[Index], Value);
+                LvalFree(Value);
+        }
+
+        struct lbench_reader *Readers = calloc(GSMax(Threads, 1), sizeof(struct lbench_reader));
+        lhistogram *Latency = malloc(sizeof(lhistogram));
+        struct timespec Pause = { 0, 100000 };
+        double TicksPerNanosecond = ClockTicksPerNanosecond();
+
+        printf("{\"size\": %u, \"repeat\": %u, \"lookups_per_thread\": %u, \"runs\": [",
+               Size, Repeat, LBENCH_LOOKUPS);
+        for(unsigned int ThreadCount = 1; ThreadCount <= Threads; ThreadCount *= 2)
+        {
+                unsigned long long Best = ~0ULL;
+                unsigned long long Publishes = 0;
+                memset(Latency, 0, sizeof(lhistogram));
+                for(unsigned int Run = 0; Run < GSMax(Repeat, 1); Run++)
+                {
+                        unsigned long long Start = ClockNanoseconds();
+                        LbenchReadersRunning = ThreadCount;
+                        for(unsigned int Index = 0; Index < ThreadCount; Index++)
+                        {
+                                Readers[Index].Env = Env;
+                                Readers[Index].Keys = Keys;
+                                Readers[Index].KeyCount = Count;
+                                Readers[Index].Seed = Run * 7919 + Index;
+                                memset(&Readers[Index].Latency, 0, sizeof(lhistogram));
+                                pthread_create(&Readers[Index].Thread, GSNullPtr, BenchLookupsReader, &Readers[Index]);
+                        }
+
+                        /* Rebinding keeps the writer publishing while the readers run. */
+                        while(__atomic_load_n(&LbenchReadersRunning, __ATOMIC_ACQUIRE) != 0)
+                        {
+                                lval *Value = LvalNumber(Publishes++);
+                                LenvPut(Env, Keys[0], Value);
+                                LvalFree(Value);
+                                nanosleep(&Pause, GSNullPtr);
+                        }
+
+                        for(unsigned int Index = 0; Index < ThreadCount; Index++)
+                        {
+                                pthread_join(Readers[Index].Thread, GSNullPtr);
+                                LhistogramMerge(Latency, &Readers[Index].Latency);
+                        }
+                        Best = GSMin(Best, ClockNanoseconds() - Start);
+                }
+
+                double Seconds = Best / 1e9;
+                printf("%s\n    {\"threads\": %u, \"best_ns\": %llu, \"lookups_per_second\": %.0f, "
+                       "\"publishes\": %llu, \"lookup_ns\": ", ThreadCount > 1 ? "," : "", ThreadCount, Best,
+                       (double)ThreadCount * LBENCH_LOOKUPS / Seconds, Publishes);
+                LhistogramPrintJson(stdout, Latency, TicksPerNanosecond);
+                printf("}");
+                fflush(stdout);
+        }
+        printf("\n]}\n");
+
+        for(unsigned int Index = 0; Index < Count; Index++) LvalFree(Keys[Index]);
+        free(Keys);
+        free(Readers);
+        free(Latency);
+        LreclaimDrainDeferred();
+        LenvFree(Env);
+}
+
+/******************************************************************************
+ * Scripts
+ *-----------------------------------------------------------------------------
+ * --script evaluates each top level expression of a file in turn and prints
+ * its result. With --cache-dir the read program is stored in the binary
+ * format, keyed by a hash of the script and grammar files, and later runs of
+ * the same script load it instead of calling mpc_parse and LvalRead. The key
+ * also covers the blob version and the error messages, since errors are
+ * stored by code and codes change meaning as errors are added.
+ *
+ * A cache entry starts with "LSPC", the full 64 bit key, the script's size and
+ * the script itself, which a load compares in full rather than trusting the
+ * hash. An entry that doesn't match or doesn't decode is stale: the script is
+ * read again and the entry rewritten. Entries are written to a temporary file and
+ * renamed, so a concurrent run never sees half an entry.
+ ******************************************************************************/
+
+#define LSCRIPT_CACHE_MAGIC "LSPC"
+#define LSCRIPT_CACHE_HEADER 20
+
+/* Returns the file's bytes, terminated for mpc_parse, or null. */
+char *
+ScriptReadFile(char *FileName, size_t *Size)
+{
+        int Fd = open(FileName, O_RDONLY);
+        if(Fd < 0) return(GSNullPtr);
+
+        struct stat Stat;
+        if(fstat(Fd, &Stat) != 0)
+        {
+                close(Fd);
+                return(GSNullPtr);
+        }
+
+        char *Result = malloc(Stat.st_size + 1);
+        size_t Read = 0;
+        while(Read < Stat.st_size)
+        {
+                ssize_t Count = read(Fd, Result + Read, Stat.st_size - Read);
+                if(Count <= 0) break;
+                Read += Count;
+        }
+        close(Fd);
+
+        Result[Read] = '\0';
+        *Size = Read;
+        return(Result);
+}
+
+unsigned long long
+ScriptHash(char *Bytes, size_t Size, unsigned long long Hash)
+{
+        /* FNV-1a */
+        for(size_t Index = 0; Index < Size; Index++)
+        {
+                Hash = (Hash ^ (unsigned char)Bytes[Index]) * 1099511628211ULL;
+        }
+        return(Hash);
+}
+
+/* Returns the cached program, or null if there is no usable entry for Script. */
+lval *
+ScriptCacheLoad(char *CacheFile, unsigned long long Key, char *Script, unsigned long long ScriptSize)
+{
+        size_t Size;
+        char *Entry = ScriptReadFile(CacheFile, &Size);
+        if(Entry == GSNullPtr) return(GSNullPtr);
 
-        while(Self->CellCount > 0)
+        lval *Result = GSNullPtr;
+        unsigned long long EntryKey = 0, EntrySize = 0;
+        if(Size > LSCRIPT_CACHE_HEADER)
         {
-                lval *Foo = LvalPop(Self, 0);
+                memcpy(&EntryKey, Entry + 4, sizeof(EntryKey));
+                memcpy(&EntrySize, Entry + 12, sizeof(EntrySize));
+        }
+        if(EntryKey == Key && EntrySize == ScriptSize && memcmp(Entry, LSCRIPT_CACHE_MAGIC, 4) == 0 &&
+           Size - LSCRIPT_CACHE_HEADER > ScriptSize &&
+           memcmp(Entry + LSCRIPT_CACHE_HEADER, Script, ScriptSize) == 0)
+        {
+                char *Blob = Entry + LSCRIPT_CACHE_HEADER + ScriptSize;
+                Result = LvalDeserialize(Blob, Size - LSCRIPT_CACHE_HEADER - ScriptSize);
+                if(Result->Type != LVAL_TYPE_SEXPRESSION)
+                {
+                        LvalFree(Result);
+                        Result = GSNullPtr;
+                }
+        }
 
-                if(GSStringIsEqual(Operator, "+", 1))
-                        Result->Number += Foo->Number;
-                if(GSStringIsEqual(Operator, "-", 1))
-                        Result->Number -= Foo->Number;
-                if(GSStringIsEqual(Operator, "*", 1))
-                        Result->Number *= Foo->Number;
-                if(GSStringIsEqual(Operator, "/", 1))
+        free(Entry);
+        return(Result);
+}
+
+void
+ScriptCacheStore(char *CacheFile, unsigned long long Key, char *Script, unsigned long long ScriptSize,
+                 lval *Program)
+{
+        lbuffer Buffer = {0};
+        LbufferPutBytes(&Buffer, LSCRIPT_CACHE_MAGIC, 4);
+        LbufferPutBytes(&Buffer, (char *)&Key, sizeof(Key));
+        LbufferPutBytes(&Buffer, (char *)&ScriptSize, sizeof(ScriptSize));
+        LbufferPutBytes(&Buffer, Script, ScriptSize);
+        if(!LvalSerialize(Program, &Buffer))
+        {
+                free(Buffer.Start);
+                return;
+        }
+
+        char TemporaryFile[4096];
+        snprintf(TemporaryFile, sizeof(TemporaryFile), "%s.%d", CacheFile, (int)getpid());
+
+        gs_bool Written = false;
+        int Fd = open(TemporaryFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(Fd >= 0)
+        {
+                Written = LbufferFlushFd(&Buffer, Fd);
+                Written &= (close(Fd) == 0);
+        }
+        free(Buffer.Start);
+
+        if(!Written || rename(TemporaryFile, CacheFile) != 0)
+        {
+                fprintf(stderr, "Couldn't write script cache entry %s\n", CacheFile);
+                unlink(TemporaryFile);
+        }
+}
+
+/* Returns the script as an S-Expression of its top level expressions, or null. */
+lval *
+ScriptRead(char *ScriptFile, char *GrammarFile, char *CacheDir, mpc_parser_t *Lispy)
+{
+        size_t ScriptSize;
+        char *Script = ScriptReadFile(ScriptFile, &ScriptSize);
+        if(Script == GSNullPtr)
+        {
+                fprintf(stderr, "Couldn't read script %s\n", ScriptFile);
+                return(GSNullPtr);
+        }
+
+        lval *Result = GSNullPtr;
+        char CacheFile[4096];
+        unsigned long long Key = 0;
+        if(CacheDir != GSNullPtr)
+        {
+                size_t GrammarSize;
+                char *Grammar = ScriptReadFile(GrammarFile, &GrammarSize);
+                char Version = LBLOB_VERSION;
+
+                Key = ScriptHash(&Version, 1, 14695981039346656037ULL);
+                for(int Code = 0; Code < LVAL_ERROR_COUNT; Code++)
                 {
-                        if(Foo->Number == 0)
+                        /* With its terminator, so the messages can't run together. */
+                        Key = ScriptHash(LvalErrors[Code].Error, GSStringLength(LvalErrors[Code].Error) + 1, Key);
+                }
+                Key = ScriptHash(Grammar, Grammar ? GrammarSize : 0, Key);
+                Key = ScriptHash(Script, ScriptSize, Key);
+                free(Grammar);
+
+                mkdir(CacheDir, 0755);
+                snprintf(CacheFile, sizeof(CacheFile), "%s/%016llx.lspc", CacheDir, Key);
+                LphaseBegin();
+                Result = ScriptCacheLoad(CacheFile, Key, Script, ScriptSize);
+                LphaseEnd(LPHASE_READ);
+        }
+
+        if(Result == GSNullPtr)
+        {
+                mpc_result_t MpcResult;
+                LphaseBegin();
+                gs_bool IsParsed = mpc_parse(ScriptFile, Script, Lispy, &MpcResult);
+                LphaseEnd(LPHASE_PARSE);
+                if(IsParsed)
+                {
+                        LallocSetTag(LALLOC_TAG_READER);
+                        LphaseBegin();
+                        Result = LvalRead(MpcResult.output);
+                        LphaseEnd(LPHASE_READ);
+                        LphaseBegin();
+                        LreclaimAst(MpcResult.output, ScriptSize);
+                        LphaseEnd(LPHASE_FREE);
+                        if(CacheDir != GSNullPtr) ScriptCacheStore(CacheFile, Key, Script, ScriptSize, Result);
+                }
+                else
+                {
+                        mpc_err_print(MpcResult.error);
+                        mpc_err_delete(MpcResult.error);
+                }
+        }
+
+        free(Script);
+        return(Result);
+}
+
+/* Returns the result of top level expression Index; the last run may consume it. */
+typedef lval *(*lscript_evaluator)(lenv *Env, lval *Program, unsigned int Index, gs_bool IsLastRun);
+
+/*
+ * Evaluates the program Repeat times, printing results on the last run only.
+ * With more than one run the mean evaluation time is written to stderr, so
+ * the interpreter and --emit-c programs can be compared.
+ */
+void
+ScriptEvaluate(lenv *Env, lval *Program, unsigned int Repeat, lscript_evaluator Evaluate)
+{
+        unsigned long long Nanoseconds = 0;
+
+        LallocSetTag(LALLOC_TAG_EVALUATOR);
+        for(unsigned int Run = 0; Run < Repeat; Run++)
+        {
+                gs_bool IsLastRun = (Run + 1 == Repeat);
+                for(unsigned int Index = 0; Index < Program->CellCount; Index++)
+                {
+                        LgovernorReset();
+                        LphaseExpressionBegin();
+                        LphaseBegin();
+                        unsigned long long Start = ClockNanoseconds();
+                        lval *Result = Evaluate(Env, Program, Index, IsLastRun);
+                        Nanoseconds += ClockNanoseconds() - Start;
+                        LphaseEnd(LPHASE_EVAL);
+
+                        size_t Printed = 0;
+                        if(IsLastRun)
                         {
-                                LvalFree(Self);
-                                LvalFree(Foo);
-                                Result = LvalError("Division by zero!");
-                                break;
+                                LphaseBegin();
+                                Printed = LvalPrintLine(Result);
+                                LphaseEnd(LPHASE_PRINT);
                         }
-                        Result->Number /= Foo->Number;
+                        LphaseBegin();
+                        if(IsLastRun) LreclaimLval(Result, Printed);
+                        else LvalFree(Result);
+                        LphaseEnd(LPHASE_FREE);
+                        LphaseExpressionEnd();
                 }
+        }
 
-                LvalFree(Foo);
+        if(Repeat > 1) fprintf(stderr, "eval: %u runs, %llu ns per run\n", Repeat, Nanoseconds / Repeat);
+}
+
+lval *
+ScriptEvaluateInterpreted(lenv *Env, lval *Program, unsigned int Index, gs_bool IsLastRun)
+{
+        lval *Expression = Program->Cell[Index];
+        return(LmemoEval(Env, IsLastRun ? Expression : LvalCopy(Expression)));
+}
+
+/* Returns false if the script couldn't be read or parsed. */
+gs_bool
+ScriptRun(lenv *Env, mpc_parser_t *Lispy, char *GrammarFile, char *ScriptFile, char *CacheDir,
+          unsigned int Repeat)
+{
+        lval *Program = ScriptRead(ScriptFile, GrammarFile, CacheDir, Lispy);
+        if(Program == GSNullPtr) return(false);
+
+        LprofileSource = ScriptFile;
+        Repeat = GSMax(Repeat, 1);
+        ScriptEvaluate(Env, Program, Repeat, ScriptEvaluateInterpreted);
+
+        /* The last run consumed the expressions. */
+        Program->CellCount = 0;
+        LvalFree(Program);
+        return(true);
+}
+
+/******************************************************************************
+ * Record and Replay
+ *-----------------------------------------------------------------------------
+ * --record file logs every line the repl reads, with the time it was read,
+ * followed by the bytes it wrote to stdout. --replay file feeds the lines
+ * back without editline, as fast as possible or, with --paced, at the times
+ * they were recorded, and checks that each line's output is byte-identical
+ * to the recording. Replay records per-phase latency as --latency does, so a
+ * captured session can be used both to time and to validate a change.
+ *
+ * Output is captured by pointing stdout's descriptor at a temporary file
+ * while a line is processed, so everything written through stdio, parse
+ * errors and builtins included, is seen. Builtins that print timings will
+ * naturally differ between runs.
+ *
+ * The file is text. After an "LSPR 1" line, each line read is recorded as
+ * "i <ns since start> <size>\n<bytes>\n" and its output as
+ * "o <size>\n<bytes>\n".
+ ******************************************************************************/
+
+#define LRECORD_MAGIC "LSPR 1\n"
+
+static FILE *LrecordFile = GSNullPtr;
+static unsigned long long LrecordStart = 0;
+
+static FILE *LcaptureFile = GSNullPtr;
+static int LcaptureStdout = -1;
+static lbuffer LcaptureBuffer = {0};
+
+/* Parses, evaluates and prints one line as the repl does. */
+void
+ReplEvaluateLine(lenv *Env, mpc_parser_t *Lispy, char *Input)
+{
+        mpc_result_t MpcResult;
+
+        LphaseExpressionBegin();
+        LphaseBegin();
+        gs_bool IsParsed = mpc_parse("<stdin>", Input, Lispy, &MpcResult);
+        LphaseEnd(LPHASE_PARSE);
+        if(IsParsed)
+        {
+                /* See Arithmetic Fast Path; the limits are per reduction. */
+                LallocSetTag(LALLOC_TAG_READER);
+                LphaseBegin();
+                gs_bool IsArithmetic = !LgovernorFuelLimit && !LgovernorByteLimit &&
+                                       !LtraceEnabled && !LprofileEnabled &&
+                                       EvalIsArithmetic(Env, MpcResult.output, 0);
+                lval *Result = IsArithmetic ? GSNullPtr : LvalRead(MpcResult.output);
+                LphaseEnd(LPHASE_READ);
+
+                LallocSetTag(LALLOC_TAG_EVALUATOR);
+                LgovernorReset();
+                LphaseBegin();
+                Result = IsArithmetic ? Eval(Env, MpcResult.output) : LmemoEval(Env, Result);
+                LphaseEnd(LPHASE_EVAL);
+
+                LphaseBegin();
+                size_t Printed = LvalPrintLine(Result);
+                LphaseEnd(LPHASE_PRINT);
+
+                LphaseBegin();
+                LreclaimLval(Result, Printed);
+                LreclaimAst(MpcResult.output, GSStringLength(Input));
+                LphaseEnd(LPHASE_FREE);
+                LphaseExpressionEnd();
+        }
+        else
+        {
+                mpc_err_print(MpcResult.error);
+                mpc_err_delete(MpcResult.error);
         }
+}
 
-        LvalFree(Self);
+gs_bool
+LcaptureOpen(void)
+{
+        LcaptureFile = tmpfile();
+        if(LcaptureFile == GSNullPtr) return(false);
+        LcaptureStdout = dup(STDOUT_FILENO);
+        return(LcaptureStdout >= 0);
+}
+
+void
+LcaptureBegin(void)
+{
+        fflush(stdout);
+        dup2(fileno(LcaptureFile), STDOUT_FILENO);
+}
+
+/* Restores stdout and leaves what was written since LcaptureBegin in LcaptureBuffer. */
+void
+LcaptureEnd(void)
+{
+        fflush(stdout);
+        dup2(LcaptureStdout, STDOUT_FILENO);
+
+        int Fd = fileno(LcaptureFile);
+        off_t Size = lseek(Fd, 0, SEEK_CUR);
+        LcaptureBuffer.Length = 0;
+        LbufferReserve(&LcaptureBuffer, Size);
+        if(pread(Fd, LcaptureBuffer.Start, Size, 0) == Size) LcaptureBuffer.Length = Size;
+
+        ftruncate(Fd, 0);
+        lseek(Fd, 0, SEEK_SET);
+}
+
+void
+LcaptureClose(void)
+{
+        if(LcaptureFile == GSNullPtr) return;
+        fclose(LcaptureFile);
+        close(LcaptureStdout);
+        free(LcaptureBuffer.Start);
+        LcaptureFile = GSNullPtr;
+}
+
+gs_bool
+LrecordOpen(char *FileName)
+{
+        LrecordFile = fopen(FileName, "w");
+        if(LrecordFile == GSNullPtr) return(false);
+        if(!LcaptureOpen())
+        {
+                fclose(LrecordFile);
+                LrecordFile = GSNullPtr;
+                return(false);
+        }
+
+        fputs(LRECORD_MAGIC, LrecordFile);
+        LrecordStart = ClockNanoseconds();
+        return(true);
+}
+
+/* Flushed per line, so a session that crashes is still recorded up to the crash. */
+void
+LrecordWrite(char *Input, unsigned long long Offset, lbuffer *Output)
+{
+        size_t InputSize = GSStringLength(Input);
+        fprintf(LrecordFile, "i %llu %zu\n", Offset, InputSize);
+        fwrite(Input, 1, InputSize, LrecordFile);
+        fprintf(LrecordFile, "\no %zu\n", Output->Length);
+        fwrite(Output->Start, 1, Output->Length, LrecordFile);
+        fputc('\n', LrecordFile);
+        fflush(LrecordFile);
+}
+
+/* Returns false if the recording couldn't be written completely. */
+gs_bool
+LrecordClose(void)
+{
+        if(LrecordFile == GSNullPtr) return(true);
+        gs_bool Result = !ferror(LrecordFile);
+        Result &= (fclose(LrecordFile) == 0);
+        LrecordFile = GSNullPtr;
+        LcaptureClose();
         return(Result);
 }
 
+/* Reads "<tag> <number>... \n" at *Cursor, or returns false. */
+gs_bool
+ReplayReadHeader(char **Cursor, char *End, char Tag, unsigned long long *Numbers, int Count)
+{
+        char *At = *Cursor;
+        if(At + 2 > End || At[0] != Tag || At[1] != ' ') return(false);
+        At += 2;
+
+        for(int Index = 0; Index < Count; Index++)
+        {
+                char *Next;
+                Numbers[Index] = strtoull(At, &Next, 10);
+                if(Next == At || Next >= End) return(false);
+                At = Next;
+        }
+        if(*At != '\n') return(false);
+
+        *Cursor = At + 1;
+        return(true);
+}
+
+void
+ReplayPrintExcerpt(char *Label, char *Bytes, size_t Size)
+{
+        fprintf(stderr, "  %s: %.*s%s\n", Label, (int)GSMin(Size, 200), Bytes, Size > 200 ? "..." : "");
+}
+
+/* Returns false if the recording couldn't be read or any output differed. */
+gs_bool
+Replay(lenv *Env, mpc_parser_t *Lispy, char *RecordFile, gs_bool IsPaced)
+{
+        size_t Size;
+        char *Recording = ScriptReadFile(RecordFile, &Size);
+        if(Recording == GSNullPtr || Size < sizeof(LRECORD_MAGIC) - 1 ||
+           memcmp(Recording, LRECORD_MAGIC, sizeof(LRECORD_MAGIC) - 1) != 0 || !LcaptureOpen())
+        {
+                fprintf(stderr, "Couldn't read recording %s\n", RecordFile);
+                free(Recording);
+                return(false);
+        }
+
+        LhistogramEnabled = true;
+
+        char *Cursor = Recording + sizeof(LRECORD_MAGIC) - 1;
+        char *End = Recording + Size;
+        unsigned int Lines = 0;
+        unsigned int Mismatches = 0;
+        gs_bool IsMalformed = false;
+        unsigned long long Start = ClockNanoseconds();
+        while(Cursor < End)
+        {
+                unsigned long long Input[2], Output[1];
+                if(!ReplayReadHeader(&Cursor, End, 'i', Input, 2) || Input[1] >= End - Cursor)
+                {
+                        IsMalformed = true;
+                        break;
+                }
+                char *Line = Cursor;
+                Cursor += Input[1];
+                *Cursor++ = '\0';
+
+                if(!ReplayReadHeader(&Cursor, End, 'o', Output, 1) || Output[0] >= End - Cursor)
+                {
+                        IsMalformed = true;
+                        break;
+                }
+                char *Expected = Cursor;
+                Cursor += Output[0] + 1;
+
+                if(IsPaced)
+                {
+                        unsigned long long Now = ClockNanoseconds() - Start;
+                        if(Input[0] > Now)
+                        {
+                                struct timespec Pause = { (Input[0] - Now) / 1000000000ULL, (Input[0] - Now) % 1000000000ULL };
+                                nanosleep(&Pause, GSNullPtr);
+                        }
+                }
+
+                LcaptureBegin();
+                ReplEvaluateLine(Env, Lispy, Line);
+                LcaptureEnd();
+
+                if(LcaptureBuffer.Length != Output[0] || memcmp(LcaptureBuffer.Start, Expected, Output[0]) != 0)
+                {
+                        if(Mismatches++ == 0)
+                        {
+                                fprintf(stderr, "replay: output of line %u differs\n", Lines + 1);
+                                ReplayPrintExcerpt("input", Line, Input[1]);
+                                ReplayPrintExcerpt("recorded", Expected, Output[0]);
+                                ReplayPrintExcerpt("replayed", LcaptureBuffer.Start, LcaptureBuffer.Length);
+                        }
+                }
+                Lines++;
+        }
+
+        fprintf(stderr, "replay: %u lines in %.3f ms, %u outputs differ%s\n", Lines,
+                (ClockNanoseconds() - Start) / 1e6, Mismatches, IsMalformed ? ", recording is malformed" : "");
+
+        LcaptureClose();
+        free(Recording);
+        return(!IsMalformed && Mismatches == 0);
+}
+
+void
+Repl(lenv *Env, mpc_parser_t *Lispy)
+{
+        puts("Lispy Version 0.0.1");
+        puts("Press Ctrl+c or Ctrl+d to exit\n");
+
+        while(true)
+        {
+                char *Input = readline("lispy> ");
+                if(Input == GSNullPtr)
+                {
+                        putchar('\n');
+                        break;
+                }
+                add_history(Input);
+
+                if(LrecordFile != GSNullPtr)
+                {
+                        unsigned long long Offset = ClockNanoseconds() - LrecordStart;
+                        LcaptureBegin();
+                        ReplEvaluateLine(Env, Lispy, Input);
+                        LcaptureEnd();
+
+                        fwrite(LcaptureBuffer.Start, 1, LcaptureBuffer.Length, stdout);
+                        LrecordWrite(Input, Offset, &LcaptureBuffer);
+                }
+                else
+                {
+                        ReplEvaluateLine(Env, Lispy, Input);
+                }
+                free(Input);
+        }
+}
+
+/******************************************************************************
+ * C Emitter
+ *-----------------------------------------------------------------------------
+ * --emit-c translates a script into a C file that includes this one as its
+ * runtime. main is left out when LISPY_RUNTIME is defined, so the output
+ * builds with:
+ *
+ *   cc -O2 -I path/to/lispy script.c path/to/lispy/mpc.c -ledit -lm -lpthread
+ *
+ * Each S-Expression whose head names a builtin becomes a C function that
+ * evaluates the arguments in order and calls the builtin directly. Trees of
+ * + - * / over numbers and symbols become long arithmetic with no lvals in
+ * between. Everything else, lambda calls included, is interpreted.
+ *
+ * def can rebind any name, so each compiled call first checks that its head
+ * is still bound to the builtin it was compiled against. If not, that
+ * expression is interpreted instead. For that the program is embedded in the
+ * binary format, and its nodes numbered in the order the emitter visits them:
+ * preorder, not descending into Q-Expressions.
+ *
+ * Compiled code uses no fuel, so --fuel and --max-bytes don't apply to it.
+ ******************************************************************************/
+
+/* An error code, or one of these for values that aren't errors. */
+#define LCOMPILED_NUMBER -1
+#define LCOMPILED_OTHER  -2
+
+struct lcompiled_program
+{
+        char *Blob;
+        size_t BlobSize;
+        char **Symbols;
+        unsigned int SymbolCount;
+        unsigned int NodeCount;
+        lval *(*Evaluate)(lenv *Env, unsigned int Index);
+};
+
+static lval **LcompiledNodes = GSNullPtr;
+static lval **LcompiledKeys = GSNullPtr;
+
+gs_bool
+LcompiledIsBound(lenv *Env, lval *Key, lbuiltin Function)
+{
+        lval *Value = LenvFind(Env->Snapshot, Key->Symbol);
+        return(Value != GSNullPtr && Value->Type == LVAL_TYPE_FUNCTION && Value->BuiltIn->Function == Function);
+}
+
 lval *
-BuiltInAdd(lenv *Env, lval *Value)
+LcompiledFallback(lenv *Env, unsigned int Node)
 {
-        lval *Result = BuiltInOperator(Env, Value, "+");
-        return(Result);
+        return(LispEval(Env, LvalCopy(LcompiledNodes[Node])));
 }
 
+/* Returns the first error among the evaluated arguments, freeing the rest. */
 lval *
-BuiltInSubtract(lenv *Env, lval *Value)
+LcompiledFirstError(lval *Arguments)
 {
-        lval *Result = BuiltInOperator(Env, Value, "-");
-        return(Result);
+        for(int Index = 0; Index < Arguments->CellCount; Index++)
+        {
+                if(Arguments->Cell[Index]->Type == LVAL_TYPE_ERROR) return(LvalTake(Arguments, Index));
+        }
+        return(GSNullPtr);
+}
+
+/* Looks up a global without copying it. */
+int
+LcompiledNumber(lenv *Env, lval *Key, long *Number)
+{
+        lval *Value = LenvFind(Env->Snapshot, Key->Symbol);
+        if(Value == GSNullPtr) return(LVAL_ERROR_UNBOUND_SYMBOL);
+        if(Value->Type == LVAL_TYPE_ERROR) return(Value->ErrorCode);
+        if(Value->Type != LVAL_TYPE_NUMBER) return(LCOMPILED_OTHER);
+
+        *Number = Value->Number;
+        return(LCOMPILED_NUMBER);
+}
+
+/* Returns the first error among Codes, in order, then NOT_A_NUMBER for anything else. */
+int
+LcompiledCheck(int *Codes, unsigned int Count)
+{
+        for(unsigned int Index = 0; Index < Count; Index++)
+        {
+                if(Codes[Index] >= 0) return(Codes[Index]);
+        }
+        for(unsigned int Index = 0; Index < Count; Index++)
+        {
+                if(Codes[Index] != LCOMPILED_NUMBER) return(LVAL_ERROR_NOT_A_NUMBER);
+        }
+        return(LCOMPILED_NUMBER);
+}
+
+int
+LcompiledDivide(long *Number, long Divisor)
+{
+        if(Divisor == 0) return(LVAL_ERROR_DIV_ZERO);
+        *Number /= Divisor;
+        return(LCOMPILED_NUMBER);
 }
 
 lval *
-BuiltInMultiply(lenv *Env, lval *Value)
+LcompiledResult(long Number, int Code)
 {
-        lval *Result = BuiltInOperator(Env, Value, "*");
-        return(Result);
+        return(Code == LCOMPILED_NUMBER ? LvalNumber(Number) : LvalError(Code));
+}
+
+/* Numbers the program's nodes the way the emitter did. */
+void
+LcompiledNumberNodes(lval *Program, unsigned int NodeCount)
+{
+        LcompiledNodes = malloc(sizeof(lval *) * GSMax(NodeCount, 1));
+
+        unsigned int Count = 0;
+        unsigned int Depth = 0;
+        unsigned int Capacity = 64;
+        lval **Pending = malloc(sizeof(lval *) * Capacity);
+        for(int Index = Program->CellCount - 1; Index >= 0; Index--)
+        {
+                if(Depth == Capacity) Pending = realloc(Pending, sizeof(lval *) * (Capacity *= 2));
+                Pending[Depth++] = Program->Cell[Index];
+        }
+
+        while(Depth > 0 && Count < NodeCount)
+        {
+                lval *Node = Pending[--Depth];
+                LcompiledNodes[Count++] = Node;
+                if(Node->Type != LVAL_TYPE_SEXPRESSION) continue;
+
+                for(int Index = Node->CellCount - 1; Index >= 0; Index--)
+                {
+                        if(Depth == Capacity) Pending = realloc(Pending, sizeof(lval *) * (Capacity *= 2));
+                        Pending[Depth++] = Node->Cell[Index];
+                }
+        }
+        free(Pending);
 }
 
+static struct lcompiled_program *LcompiledProgram = GSNullPtr;
+
 lval *
-BuiltInDivide(lenv *Env, lval *Value)
+LcompiledEvaluate(lenv *Env, lval *Program, unsigned int Index, gs_bool IsLastRun)
 {
-        lval *Result = BuiltInOperator(Env, Value, "/");
-        return(Result);
+        return(LcompiledProgram->Evaluate(Env, Index));
 }
 
-lval *
-BuiltInHead(lenv *Env, lval *Self)
-{
-        LASSERT(Self, Self->CellCount == 1,
-                "Function 'head' passed too many arguments!");
-        LASSERT(Self, Self->Cell[0]->Type == LVAL_TYPE_QEXPRESSION,
-                "Function 'head' passed incorrect type!");
-        LASSERT(Self, Self->Cell[0]->CellCount != 0,
-                "Function 'head' passed {}!");
+/* main for an --emit-c program. Takes --repeat n, like --script. */
+int
+LcompiledMain(struct lcompiled_program *Program, int ArgCount, char *Arguments[])
+{
+        ClockInit();
+
+        gs_args *Args = alloca(sizeof(gs_args));
+        GSArgsInit(Args, ArgCount, Arguments);
+        char *Repeat = GSArgsAfter(Args, "--repeat");
+
+        lenv *Env = LenvNew();
+        LenvAddBuiltIns(Env);
+
+        lval *Tree = LvalDeserialize(Program->Blob, Program->BlobSize);
+        if(Tree->Type != LVAL_TYPE_SEXPRESSION)
+        {
+                LvalPrintLine(Tree);
+                return(EXIT_FAILURE);
+        }
 
-        lval *Result = LvalTake(Self, 0);
-        while(Result->CellCount > 1)
+        LcompiledKeys = malloc(sizeof(lval *) * GSMax(Program->SymbolCount, 1));
+        for(unsigned int Index = 0; Index < Program->SymbolCount; Index++)
         {
-                LvalFree(LvalPop(Result, 1));
+                LcompiledKeys[Index] = LvalSymbol(Program->Symbols[Index]);
         }
+        LcompiledNumberNodes(Tree, Program->NodeCount);
+        LcompiledProgram = Program;
 
-        return(Result);
+        ScriptEvaluate(Env, Tree, Repeat ? GSMax(strtoul(Repeat, GSNullPtr, 10), 1) : 1, LcompiledEvaluate);
+        LreclaimStop();
+
+        for(unsigned int Index = 0; Index < Program->SymbolCount; Index++) LvalFree(LcompiledKeys[Index]);
+        free(LcompiledKeys);
+        free(LcompiledNodes);
+        LvalFree(Tree);
+        LenvFree(Env);
+        LenvFramePoolFree();
+        return(EXIT_SUCCESS);
 }
 
-lval *
-BuiltInTail(lenv *Env, lval *Self)
+struct lemit
 {
-        LASSERT(Self, Self->CellCount == 1,
-                "Function 'tail' passed too many arguments!");
-        LASSERT(Self, Self->Cell[0]->Type == LVAL_TYPE_QEXPRESSION,
-                "Function 'tail' passed incorrect type!");
-        LASSERT(Self, Self->Cell[0]->CellCount != 0,
-                "Function 'tail' passed {}!");
+        lenv *Env;
+        FILE *File;
 
-        lval *Result = LvalTake(Self, 0);
-        LvalFree(LvalPop(Result, 0));
-        return(Result);
-}
+        /* Next node number, in the order LcompiledNumberNodes uses. */
+        unsigned int NodeCount;
 
-lval *
-BuiltInList(lenv *Env, lval *Self)
-{
-        Self->Type = LVAL_TYPE_QEXPRESSION;
-        return(Self);
-}
+        /* Symbols used as keys, indexed by an open addressed table of their slots. */
+        lsymbol **Symbols;
+        unsigned int SymbolCount;
+        unsigned int *Slots;
+        unsigned int SlotCount;
 
-lval *LispEval(lenv *Env, lval *Self);
+        /* Heads the function being emitted must find still bound to their builtin. */
+        lval *Guards[64];
+        unsigned int GuardCount;
+};
 
-lval *
-BuiltInEval(lenv *Env, lval *Self)
+void
+EmitPrintf(lbuffer *Out, char *Format, ...)
 {
-        LASSERT(Self, Self->CellCount == 1,
-                "Function 'eval' passed too many arguments!");
-        LASSERT(Self, Self->Cell[0]->Type == LVAL_TYPE_QEXPRESSION,
-                "Function 'eval' passed incorrect type!");
-
-        lval *Result = LvalTake(Self, 0);
-        Result->Type = LVAL_TYPE_SEXPRESSION;
-        return(LispEval(Env, Result));
+        char Text[512];
+        va_list Arguments;
+        va_start(Arguments, Format);
+        vsnprintf(Text, sizeof(Text), Format, Arguments);
+        va_end(Arguments);
+        LbufferPutString(Out, Text);
 }
 
-lval *
-BuiltInJoin__(lval *Left, lval *Right)
+/* Returns the index of Symbol's key in LcompiledKeys. */
+unsigned int
+EmitKey(struct lemit *Self, lsymbol *Symbol)
 {
-        while(Right->CellCount)
+        if(Self->SymbolCount * 2 >= Self->SlotCount)
         {
-                Left = LvalAdd(Left, LvalPop(Right, 0));
+                unsigned int SlotCount = GSMax(Self->SlotCount * 2, 64);
+                unsigned int *Slots = malloc(sizeof(unsigned int) * SlotCount);
+                memset(Slots, 0xff, sizeof(unsigned int) * SlotCount);
+                for(unsigned int Index = 0; Index < Self->SymbolCount; Index++)
+                {
+                        unsigned int Slot = Self->Symbols[Index]->Hash & (SlotCount - 1);
+                        while(Slots[Slot] != ~0u) Slot = (Slot + 1) & (SlotCount - 1);
+                        Slots[Slot] = Index;
+                }
+                free(Self->Slots);
+                Self->Slots = Slots;
+                Self->SlotCount = SlotCount;
+                Self->Symbols = realloc(Self->Symbols, sizeof(lsymbol *) * SlotCount);
         }
 
-        LvalFree(Right);
-        return(Left);
+        unsigned int Slot = Symbol->Hash & (Self->SlotCount - 1);
+        while(Self->Slots[Slot] != ~0u)
+        {
+                if(Self->Symbols[Self->Slots[Slot]] == Symbol) return(Self->Slots[Slot]);
+                Slot = (Slot + 1) & (Self->SlotCount - 1);
+        }
+
+        Self->Slots[Slot] = Self->SymbolCount;
+        Self->Symbols[Self->SymbolCount] = Symbol;
+        return(Self->SymbolCount++);
 }
 
-lval *
-BuiltInJoin(lenv *Env, lval *Self)
+/* Returns the builtin Self is bound to in a fresh environment, or null. */
+lbuiltin_info *
+EmitBuiltIn(struct lemit *Emit, lval *Self)
 {
-        for(int Cell = 0; Cell < Self->CellCount; Cell++)
-        {
-                LASSERT(Self, Self->Cell[Cell]->Type == LVAL_TYPE_QEXPRESSION,
-                        "Function 'join' passed incorrect type!");
-        }
+        if(Self->Type != LVAL_TYPE_SYMBOL) return(GSNullPtr);
+        lval *Value = LenvFind(Emit->Env->Snapshot, Self->Symbol);
+        return((Value != GSNullPtr && Value->Type == LVAL_TYPE_FUNCTION) ? Value->BuiltIn : GSNullPtr);
+}
 
-        lval *Result = LvalPop(Self, 0);
+/* Returns the operator if Self is a call to + - * or /. */
+char
+EmitOperator(struct lemit *Emit, lval *Self)
+{
+        if(Self->Type != LVAL_TYPE_SEXPRESSION || Self->CellCount < 2) return(0);
 
-        while(Self->CellCount)
+        lbuiltin_info *BuiltIn = EmitBuiltIn(Emit, Self->Cell[0]);
+        if(BuiltIn == GSNullPtr) return(0);
+        if(BuiltIn->Function == BuiltInAdd) return('+');
+        if(BuiltIn->Function == BuiltInSubtract) return('-');
+        if(BuiltIn->Function == BuiltInMultiply) return('*');
+        if(BuiltIn->Function == BuiltInDivide) return('/');
+        return(0);
+}
+
+/* Returns false if the function being emitted already has too many guards. */
+gs_bool
+EmitGuard(struct lemit *Emit, lval *Head)
+{
+        for(unsigned int Index = 0; Index < Emit->GuardCount; Index++)
         {
-                Result = BuiltInJoin__(Result, LvalPop(Self, 0));
+                if(Emit->Guards[Index]->Symbol == Head->Symbol) return(true);
         }
+        if(Emit->GuardCount == GSArraySize(Emit->Guards)) return(false);
 
-        LvalFree(Self);
-        return(Result);
+        Emit->Guards[Emit->GuardCount++] = Head;
+        return(true);
 }
 
-lval *
-BuiltIn(lenv *Env, lval *Self, char *Function)
+/*
+ * True if Self can be computed as a long: numbers and symbols under + - * /.
+ * Each operator needs a guard, so trees with too many distinct ones are not.
+ */
+gs_bool
+EmitIsArithmetic(struct lemit *Emit, lval *Self)
 {
-        if(GSStringIsEqual(Function, "list", 4)) return(BuiltInList(Env, Self));
-        if(GSStringIsEqual(Function, "head", 4)) return(BuiltInHead(Env, Self));
-        if(GSStringIsEqual(Function, "tail", 4)) return(BuiltInTail(Env, Self));
-        if(GSStringIsEqual(Function, "join", 4)) return(BuiltInJoin(Env, Self));
-        if(GSStringIsEqual(Function, "eval", 4)) return(BuiltInEval(Env, Self));
-        if(GSStringHasSubstring("+-/*", 4, Function, 1)) return(BuiltInOperator(Env, Self, Function));
+        if(!EmitOperator(Emit, Self) || !EmitGuard(Emit, Self->Cell[0])) return(false);
 
-        LvalFree(Self);
+        for(int Index = 1; Index < Self->CellCount; Index++)
+        {
+                lval *Cell = Self->Cell[Index];
+                if(Cell->Type == LVAL_TYPE_NUMBER || Cell->Type == LVAL_TYPE_SYMBOL ||
+                   Cell->Type == LVAL_TYPE_ERROR) continue;
+                if(!EmitIsArithmetic(Emit, Cell)) return(false);
+        }
+        return(true);
+}
 
-        lval *Result = LvalError("Unknown Function!");
-        return(Result);
+void
+EmitNumberLiteral(char *Out, size_t Size, long Number)
+{
+        /* The most negative long has no literal of its own. */
+        if(Number == LONG_MIN) snprintf(Out, Size, "(%ldL - 1)", Number + 1);
+        else snprintf(Out, Size, "%ldL", Number);
 }
 
-lval *
-LispEvalSExpression(lenv *Env, lval *Self)
+/* C expressions for a value computed as a long, and its code. */
+struct lemit_operand
 {
-        lval *Result = GSNullPtr;
+        char Value[32];
+        char Code[32];
+};
 
-        /* Evaluate all children. */
-        for(int Cell = 0; Cell < Self->CellCount; Cell++)
+/*
+ * Writes the C expression folding Operands with Operator, which isn't /. It
+ * is done in unsigned long, so overflow wraps as the interpreter's does
+ * rather than being undefined, and literal operands fold without -Woverflow.
+ */
+void
+EmitFold(lbuffer *Body, char Operator, struct lemit_operand *Operands, unsigned int Count)
+{
+        if(Operator == '-' && Count == 1)
         {
-                Self->Cell[Cell] = LispEval(Env, Self->Cell[Cell]);
+                EmitPrintf(Body, "(long)(0UL - (unsigned long)%s)", Operands[0].Value);
+                return;
         }
 
-        /* Check for errors. */
-        for(int Cell = 0; Cell < Self->CellCount; Cell++)
+        EmitPrintf(Body, "(long)((unsigned long)%s", Operands[0].Value);
+        for(unsigned int Index = 1; Index < Count; Index++)
         {
-                if(Self->Cell[Cell]->Type == LVAL_TYPE_ERROR)
+                EmitPrintf(Body, " %c (unsigned long)%s", Operator, Operands[Index].Value);
+        }
+        EmitPrintf(Body, ")");
+}
+
+/* Writes statements computing Self; literals need none and go straight into Result. */
+void
+EmitArithmetic(struct lemit *Emit, lval *Self, lbuffer *Body, struct lemit_operand *Result)
+{
+        unsigned int Node = Emit->NodeCount++;
+        switch(Self->Type)
+        {
+                case(LVAL_TYPE_NUMBER):
                 {
-                        Result = LvalTake(Self, Cell);
-                        return(Result);
-                }
+                        EmitNumberLiteral(Result->Value, 32, Self->Number);
+                        snprintf(Result->Code, 32, "LCOMPILED_NUMBER");
+                } return;
+                case(LVAL_TYPE_ERROR):
+                {
+                        snprintf(Result->Value, 32, "0L");
+                        snprintf(Result->Code, 32, "%d", Self->ErrorCode);
+                } return;
+                case(LVAL_TYPE_SYMBOL):
+                {
+                        EmitPrintf(Body, "        long V%u = 0; int E%u = LcompiledNumber(Env, LcompiledKeys[%u], &V%u);\n",
+                                   Node, Node, EmitKey(Emit, Self->Symbol), Node);
+                        snprintf(Result->Value, 32, "V%u", Node);
+                        snprintf(Result->Code, 32, "E%u", Node);
+                } return;
         }
 
-        /* Empty S-Expression. */
-        if(Self->CellCount == 0) return(Self);
+        /* The operator's own node. */
+        char Operator = EmitOperator(Emit, Self);
+        Emit->NodeCount++;
 
-        /* Single element in S-Expression; ie., Single Expression. */
-        if(Self->CellCount == 1)
+        unsigned int Count = Self->CellCount - 1;
+        struct lemit_operand *Operands = calloc(Count, sizeof(struct lemit_operand));
+        for(unsigned int Index = 0; Index < Count; Index++)
         {
-                Result = LvalTake(Self, 0);
-                return(Result);
+                EmitArithmetic(Emit, Self->Cell[Index + 1], Body, &Operands[Index]);
         }
 
-        /* Ensure first element is a symbol. */
-        lval *FirstElement = LvalPop(Self, 0);
-        if(FirstElement->Type != LVAL_TYPE_FUNCTION)
+        /* Only operands that may not be numbers need checking, in argument order. */
+        lbuffer Check = { 0 };
+        unsigned int CheckCount = 0;
+        for(unsigned int Index = 0; Index < Count; Index++)
         {
-                LvalFree(Self);
-                LvalFree(FirstElement);
-                Result = LvalError("First element is not a function!");
-                return(Result);
+                if(strcmp(Operands[Index].Code, "LCOMPILED_NUMBER") == 0) continue;
+                EmitPrintf(&Check, "%s%s", CheckCount++ ? ", " : "", Operands[Index].Code);
+        }
+        /*
+         * A divisor can only be trusted if it is a literal other than zero; computed ones are Vn.
+         * Dividing by -1 can overflow, so it is left to LcompiledDivide at run time too.
+         */
+        gs_bool IsChecked = (CheckCount != 0);
+        for(unsigned int Index = 1; Index < Count && Operator == '/'; Index++)
+        {
+                char *Divisor = Operands[Index].Value;
+                if(Divisor[0] == 'V' || strcmp(Divisor, "0L") == 0 || strcmp(Divisor, "-1L") == 0) IsChecked = true;
         }
 
-        Result = FirstElement->Function(Env, Self);
-        LvalFree(FirstElement);
-        return(Result);
-}
-
-lval *
-LispEval(lenv *Env, lval *Value)
-{
-        lval *Result = GSNullPtr;
+        snprintf(Result->Value, 32, "V%u", Node);
+        snprintf(Result->Code, 32, IsChecked ? "E%u" : "LCOMPILED_NUMBER", Node);
 
-        if(Value->Type == LVAL_TYPE_SYMBOL)
+        if(!IsChecked && Operator == '/')
         {
-                Result = LenvGet(Env, Value);
-                LvalFree(Value);
-                return(Result);
+                EmitPrintf(Body, "        long V%u = %s", Node, Operands[0].Value);
+                for(unsigned int Index = 1; Index < Count; Index++)
+                {
+                        EmitPrintf(Body, " / %s", Operands[Index].Value);
+                }
+                EmitPrintf(Body, ";\n");
         }
-        else if(Value->Type == LVAL_TYPE_SEXPRESSION)
+        else if(!IsChecked)
         {
-                Result = LispEvalSExpression(Env, Value);
-                return(Result);
+                EmitPrintf(Body, "        long V%u = ", Node);
+                EmitFold(Body, Operator, Operands, Count);
+                EmitPrintf(Body, ";\n");
         }
-        /* TODO(AARON): Delete the following case? */
         else
         {
-                Result = Value;
-                return(Result);
+                if(CheckCount != 0)
+                {
+                        EmitPrintf(Body, "        long V%u = 0; int E%u = LcompiledCheck((int []){ ", Node, Node);
+                        LbufferPutBytes(Body, Check.Start, Check.Length);
+                        EmitPrintf(Body, " }, %u);\n", CheckCount);
+                }
+                else
+                {
+                        EmitPrintf(Body, "        long V%u = 0; int E%u = LCOMPILED_NUMBER;\n", Node, Node);
+                }
+
+                if(Operator == '/')
+                {
+                        EmitPrintf(Body, "        if(E%u == LCOMPILED_NUMBER) V%u = %s;\n", Node, Node, Operands[0].Value);
+                        for(unsigned int Index = 1; Index < Count; Index++)
+                        {
+                                EmitPrintf(Body, "        if(E%u == LCOMPILED_NUMBER) E%u = LcompiledDivide(&V%u, %s);\n",
+                                           Node, Node, Node, Operands[Index].Value);
+                        }
+                }
+                else
+                {
+                        EmitPrintf(Body, "        if(E%u == LCOMPILED_NUMBER) V%u = ", Node, Node);
+                        EmitFold(Body, Operator, Operands, Count);
+                        EmitPrintf(Body, ";\n");
+                }
         }
 
-        return(Result);
+        free(Check.Start);
+        free(Operands);
 }
 
-lval *
-EvalOperator(lval *A, char *Operator, lval *B)
+/* Skips the node numbers of an expression that is interpreted as a whole. */
+void
+EmitSkip(struct lemit *Emit, lval *Self)
 {
-        lval *Result;
+        Emit->NodeCount++;
+        if(Self->Type != LVAL_TYPE_SEXPRESSION) return;
+        for(int Index = 0; Index < Self->CellCount; Index++) EmitSkip(Emit, Self->Cell[Index]);
+}
 
-        if(A->Type == LVAL_TYPE_ERROR) { return(A); }
-        if(B->Type == LVAL_TYPE_ERROR) { return(B); }
+void EmitExpression(struct lemit *Emit, lval *Self, lbuffer *Out);
 
-        if(GSStringIsEqual(Operator, "+", 1)) { return(LvalNumber(A->Number + B->Number)); }
-        if(GSStringIsEqual(Operator, "-", 1)) { return(LvalNumber(A->Number - B->Number)); }
-        if(GSStringIsEqual(Operator, "*", 1)) { return(LvalNumber(A->Number * B->Number)); }
-        if(GSStringIsEqual(Operator, "/", 1))
+/*
+ * Writes the function for Self, a call whose head names a builtin, and
+ * returns its node number.
+ */
+unsigned int
+EmitFunction(struct lemit *Emit, lval *Self)
+{
+        unsigned int Node = Emit->NodeCount;
+        unsigned int SavedGuardCount = Emit->GuardCount;
+        lval *SavedGuards[GSArraySize(Emit->Guards)];
+        GSMemoryCopy(Emit->Guards, SavedGuards, sizeof(SavedGuards));
+        Emit->GuardCount = 0;
+
+        lbuffer Body = { 0 };
+        if(EmitIsArithmetic(Emit, Self))
         {
-                if(B->Number == 0)
-                {
-                        Result = LvalError(LVAL_ERROR_DIV_ZERO);
-                        return(Result);
-                }
-                else
+                struct lemit_operand Result;
+                EmitArithmetic(Emit, Self, &Body, &Result);
+                EmitPrintf(&Body, "        return(LcompiledResult(%s, %s));\n", Result.Value, Result.Code);
+        }
+        else
+        {
+                /* Guards gathered by EmitIsArithmetic belong to nested calls. */
+                Emit->GuardCount = 0;
+                EmitGuard(Emit, Self->Cell[0]);
+                Emit->NodeCount += 2;
+
+                LbufferPutString(&Body, "        lval *Arguments = LvalSExpression();\n");
+                for(int Index = 1; Index < Self->CellCount; Index++)
                 {
-                        Result = LvalNumber(A->Number / B->Number);
-                        return(Result);
+                        LbufferPutString(&Body, "        LvalAdd(Arguments, ");
+                        EmitExpression(Emit, Self->Cell[Index], &Body);
+                        LbufferPutString(&Body, ");\n");
                 }
+                EmitPrintf(&Body, "        lval *Error = LcompiledFirstError(Arguments);\n"
+                           "        if(Error != GSNullPtr) return(Error);\n"
+                           "        return(%s(Env, Arguments));\n", EmitBuiltIn(Emit, Self->Cell[0])->CName);
         }
 
-        Result = LvalError("Unknown Operator");
-        return(Result);
+        fprintf(Emit->File, "static lval *\nLcompiledExpression%u(lenv *Env)\n{\n        if(", Node);
+        for(unsigned int Index = 0; Index < Emit->GuardCount; Index++)
+        {
+                lval *Head = Emit->Guards[Index];
+                fprintf(Emit->File, "%s!LcompiledIsBound(Env, LcompiledKeys[%u], %s)",
+                        Index ? " ||\n           " : "", EmitKey(Emit, Head->Symbol), EmitBuiltIn(Emit, Head)->CName);
+        }
+        fprintf(Emit->File, ") return(LcompiledFallback(Env, %u));\n\n", Node);
+        fwrite(Body.Start, 1, Body.Length, Emit->File);
+        fprintf(Emit->File, "}\n\n");
+        free(Body.Start);
+
+        GSMemoryCopy(SavedGuards, Emit->Guards, sizeof(SavedGuards));
+        Emit->GuardCount = SavedGuardCount;
+        return(Node);
 }
 
-lval *
-Eval(mpc_ast_t *Tree)
+/* Writes a C expression that evaluates Self to an lval. */
+void
+EmitExpression(struct lemit *Emit, lval *Self, lbuffer *Out)
 {
-        lval *Result;
-
-        char *Tag = Tree->tag;
-        unsigned int TagLength = GSStringLength(Tag);
-        if(GSStringHasSubstring(Tag, GSStringLength(Tag), "number", GSMin(TagLength, 6)))
+        unsigned int Node = Emit->NodeCount;
+        switch(Self->Type)
         {
-                errno = 0;
-                long Number = strtol(Tree->contents, NULL, 10);
-                if(errno == ERANGE)
+                case(LVAL_TYPE_NUMBER):
                 {
-                        Result = LvalError("Number too large");
-                }
-                else
+                        Emit->NodeCount++;
+                        char Literal[32];
+                        EmitNumberLiteral(Literal, sizeof(Literal), Self->Number);
+                        EmitPrintf(Out, "LvalNumber(%s)", Literal);
+                } return;
+                case(LVAL_TYPE_ERROR):
                 {
-                        Result = LvalNumber(Number);
-                }
+                        Emit->NodeCount++;
+                        EmitPrintf(Out, "LvalError(%d)", Self->ErrorCode);
+                } return;
+                case(LVAL_TYPE_SYMBOL):
+                {
+                        Emit->NodeCount++;
+                        EmitPrintf(Out, "LenvGet(Env, LcompiledKeys[%u])", EmitKey(Emit, Self->Symbol));
+                } return;
+                case(LVAL_TYPE_SEXPRESSION):
+                {
+                        if(Self->CellCount == 0)
+                        {
+                                Emit->NodeCount++;
+                                LbufferPutString(Out, "LvalSExpression()");
+                                return;
+                        }
+                        if(Self->CellCount == 1)
+                        {
+                                /* (x) evaluates to whatever x does. */
+                                Emit->NodeCount++;
+                                EmitExpression(Emit, Self->Cell[0], Out);
+                                return;
+                        }
+                        if(EmitBuiltIn(Emit, Self->Cell[0]) != GSNullPtr)
+                        {
+                                EmitPrintf(Out, "LcompiledExpression%u(Env)", EmitFunction(Emit, Self));
+                                return;
+                        }
+                } break;
+                case(LVAL_TYPE_QEXPRESSION):
+                {
+                        Emit->NodeCount++;
+                        EmitPrintf(Out, "LvalCopy(LcompiledNodes[%u])", Node);
+                } return;
+        }
 
-                return(Result);
+        EmitSkip(Emit, Self);
+        EmitPrintf(Out, "LcompiledFallback(Env, %u)", Node);
+}
+
+/* Returns false if the output couldn't be written. */
+gs_bool
+EmitC(lenv *Env, lval *Program, char *ScriptFile, char *OutputFile)
+{
+        struct lemit Emit = { .Env = Env };
+        Emit.File = fopen(OutputFile, "w");
+        if(Emit.File == GSNullPtr) return(false);
+
+        fprintf(Emit.File, "/* Generated by lispy --emit-c from %s. */\n\n"
+                "#define LISPY_RUNTIME\n#include \"main.c\"\n\n", ScriptFile);
+
+        lbuffer Evaluate = { 0 };
+        LbufferPutString(&Evaluate, "static lval *\nLcompiledEvaluateExpression(lenv *Env, unsigned int Index)\n{\n"
+                         "        switch(Index)\n        {\n");
+        for(int Index = 0; Index < Program->CellCount; Index++)
+        {
+                EmitPrintf(&Evaluate, "                case(%d): return(", Index);
+                EmitExpression(&Emit, Program->Cell[Index], &Evaluate);
+                LbufferPutString(&Evaluate, ");\n");
         }
+        LbufferPutString(&Evaluate, "        }\n        return(LvalSExpression());\n}\n\n");
+        fwrite(Evaluate.Start, 1, Evaluate.Length, Emit.File);
+        free(Evaluate.Start);
 
-        char *Operator = Tree->children[1]->contents;
-        lval *Parameter = Eval(Tree->children[2]);
+        lbuffer Blob = { 0 };
+        gs_bool Result = LvalSerialize(Program, &Blob);
 
-        int i = 3;
-        while(GSStringHasSubstring(Tree->children[i]->tag, 0, "expr", 4))
+        fprintf(Emit.File, "static char LcompiledBlob[] =");
+        for(size_t Index = 0; Index < Blob.Length; Index++)
+        {
+                if(Index % 16 == 0) fprintf(Emit.File, "\n        \"");
+                fprintf(Emit.File, "\\%03o", (unsigned char)Blob.Start[Index]);
+                if(Index % 16 == 15 || Index + 1 == Blob.Length) fprintf(Emit.File, "\"");
+        }
+        fprintf(Emit.File, "%s;\n\nstatic char *LcompiledSymbols[] =\n{\n", Blob.Length ? "" : " \"\"");
+        for(unsigned int Index = 0; Index < Emit.SymbolCount; Index++)
         {
-                Parameter = EvalOperator(Parameter, Operator, Eval(Tree->children[i]));
-                i++;
+                fprintf(Emit.File, "        \"");
+                for(char *C = Emit.Symbols[Index]->Name; *C; C++)
+                {
+                        if(*C == '\\' || *C == '"') fputc('\\', Emit.File);
+                        fputc(*C, Emit.File);
+                }
+                fprintf(Emit.File, "\",\n");
         }
+        fprintf(Emit.File, "        0\n};\n\n"
+                "static struct lcompiled_program LcompiledThisProgram =\n{\n"
+                "        LcompiledBlob, sizeof(LcompiledBlob) - 1,\n"
+                "        LcompiledSymbols, %u,\n"
+                "        %u,\n"
+                "        LcompiledEvaluateExpression\n"
+                "};\n\n"
+                "int\nmain(int ArgCount, char *Arguments[])\n{\n"
+                "        return(LcompiledMain(&LcompiledThisProgram, ArgCount, Arguments));\n}\n",
+                Emit.SymbolCount, Emit.NodeCount);
 
-        return(Parameter);
+        free(Blob.Start);
+        free(Emit.Symbols);
+        free(Emit.Slots);
+        Result &= !ferror(Emit.File);
+        Result &= (fclose(Emit.File) == 0);
+        return(Result);
 }
 
 void
 Usage(char *ProgramName)
 {
-        printf("Usage: %s mpc_file\n\n", ProgramName);
+        printf("Usage: %s mpc_file [--save-grammar blob_file] [--trace trace_file]\n"
+               "                [--memo bytes] [--fuel n] [--max-bytes n] [--jit threshold]\n"
+               "                [--profile folded_file [--sample-hz n]] [--perf-counters] [--latency]\n"
+               "                [--record session_file | --replay session_file [--paced]]\n"
+               "                [--script script_file [--cache-dir dir] [--repeat n] [--emit-c c_file]]\n"
+               "                [--reclaim bytes [--reclaim-max-pending bytes]]\n"
+               "       %s mpc_file --bench all|name[,name...] [--size n] [--repeat n] [--warmup n]\n"
+               "       %s mpc_file --bench-lookups threads [--size n] [--repeat n]\n\n",
+               ProgramName, ProgramName, ProgramName);
         puts("Reads mpc_file and launches a repl to interactively test the generated parser.");
+        puts("mpc_file may be a grammar or a blob written earlier with --save-grammar.");
+        puts("With --save-grammar the compiled grammar is written to blob_file and the");
+        puts("program exits. Loading a blob skips building the parser with mpca_lang.");
+        puts("With --bench the named generated workloads are run and per-phase timings");
+        puts("(parse, read, eval, copy, print, free) are written to stdout as JSON.");
+        puts("Workloads: nesting, wide, qexpr, symbols, print, errors, checks, calls,");
+        puts("deep, flat.");
+        puts("With --bench-lookups 1, 2, 4 ... up to threads readers look up n globals");
+        puts("while the main thread keeps redefining one, and lookups per second and");
+        puts("lookup latency percentiles are written to stdout as JSON.");
+        puts("With --trace evaluation is traced and written to trace_file as Chrome trace");
+        puts("JSON by trace-dump, on SIGUSR1 and on exit.");
+        puts("With --memo results of pure top level expressions are cached, using at most");
+        puts("bytes of memory. The memo builtin prints hit and miss counts.");
+        puts("With --fuel or --max-bytes each top level expression is stopped with an error");
+        puts("after n evaluation steps or n bytes allocated.");
+        puts("With --jit lambda bodies and eval'd expressions that are arithmetic on numbers");
+        puts("and symbols are compiled to x86-64 after running threshold times. The jit");
+        puts("builtin prints how many were compiled and how often they ran natively.");
+        puts("With --profile evaluation is sampled n times per CPU second (default 1000)");
+        puts("and the stacks of calls being evaluated, with their script lines, are written");
+        puts("to folded_file for flamegraph.pl on profile-stop and on exit. profile-start");
+        puts("clears the samples and starts again.");
+        puts("With --perf-counters CPU time, cycles, instructions, cache misses and branch");
+        puts("misses are counted with perf_event_open for each phase (parse, read, eval,");
+        puts("print, free) and printed with IPC by perf-counters and on exit.");
+        puts("With --latency each phase and each whole expression is timed into a histogram");
+        puts("and p50, p90, p99, p99.9 and max are printed by latency and on exit.");
+        puts("With --record each line the repl reads is written to session_file with its");
+        puts("time and output. --replay evaluates the lines again without the repl, at once");
+        puts("or with --paced at the recorded times, prints latency percentiles, and fails");
+        puts("if any line's output isn't byte-identical to the recording.");
+        puts("With --script each expression in script_file is evaluated and printed instead");
+        puts("of starting the repl. With --cache-dir the read script is cached in dir and");
+        puts("later runs of an unchanged script with the same grammar skip parsing it.");
+        puts("With --repeat the script is evaluated n times, results are printed once and");
+        puts("the mean evaluation time is written to stderr.");
+        puts("With --emit-c the script is translated to C and written to c_file instead.");
+        puts("Build it with: cc -O2 -I lispy_dir c_file lispy_dir/mpc.c -ledit -lm -lpthread");
+        puts("The program takes --repeat n too, for comparison with the interpreter.");
+        puts("With --reclaim results and inputs printing to at least bytes are freed on a");
+        puts("background thread. If more than --reclaim-max-pending bytes (default 64MB)");
+        puts("are waiting, they are freed inline instead.");
         exit(EXIT_SUCCESS);
 }
 
+#ifndef LISPY_RUNTIME
 int
 main(int ArgCount, char *Arguments[])
 {
+        ClockInit();
+
         gs_args *Args = alloca(sizeof(gs_args));
         GSArgsInit(Args, ArgCount, Arguments);
         if(GSArgsHelpWanted(Args) || ArgCount < 2) Usage(GSArgsProgramName(Args));
@@ -768,44 +6453,166 @@ main(int ArgCount, char *Arguments[])
         mpc_parser_t *Expr   = mpc_new("expr");
         mpc_parser_t *Lispy  = mpc_new("lispy");
 
-        size_t FileSize = GSFileSize(GrammarFile);
-        gs_buffer *FileBuffer = alloca(sizeof(gs_buffer));
-        GSBufferInit(FileBuffer, malloc(FileSize), FileSize);
-        GSFileCopyToBuffer(GrammarFile, FileBuffer);
+        /* Try a precompiled blob first; anything else is grammar source. */
+        mpc_err_t *GrammarError = mpc_load(GrammarFile, 6,
+                                           Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+        if(GrammarError != GSNullPtr)
+        {
+                mpc_err_delete(GrammarError);
 
-        mpca_lang(MPCA_LANG_DEFAULT,
-                  FileBuffer->Start,
-                  Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+                size_t FileSize = GSFileSize(GrammarFile);
+                gs_buffer *FileBuffer = alloca(sizeof(gs_buffer));
+                GSBufferInit(FileBuffer, malloc(FileSize + 1), FileSize + 1);
+                GSFileCopyToBuffer(GrammarFile, FileBuffer);
 
-        puts("Lispy Version 0.0.1");
-        puts("Press Ctrl+c to exit\n");
+                GrammarError = mpca_lang(MPCA_LANG_DEFAULT,
+                                         FileBuffer->Start,
+                                         Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+                free(FileBuffer->Start);
+                if(GrammarError != GSNullPtr)
+                {
+                        mpc_err_print(GrammarError);
+                        mpc_err_delete(GrammarError);
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        char *BlobFile = GSArgsAfter(Args, "--save-grammar");
+        if(BlobFile != GSNullPtr)
+        {
+                GrammarError = mpc_save(BlobFile, 6,
+                                        Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+                if(GrammarError != GSNullPtr)
+                {
+                        mpc_err_print(GrammarError);
+                        mpc_err_delete(GrammarError);
+                        exit(EXIT_FAILURE);
+                }
+                mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+                exit(EXIT_SUCCESS);
+        }
+
+        char *LookupThreads = GSArgsAfterExact(Args, "--bench-lookups");
+        if(LookupThreads != GSNullPtr)
+        {
+                char *Size = GSArgsAfter(Args, "--size");
+                char *Repeat = GSArgsAfter(Args, "--repeat");
+                BenchLookups(strtoul(LookupThreads, GSNullPtr, 10),
+                             Size ? strtoul(Size, GSNullPtr, 10) : 1000,
+                             Repeat ? strtoul(Repeat, GSNullPtr, 10) : 3);
+                mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+                exit(EXIT_SUCCESS);
+        }
+
+        char *BenchNames = GSArgsAfterExact(Args, "--bench");
+        if(BenchNames != GSNullPtr)
+        {
+                char *Size = GSArgsAfter(Args, "--size");
+                char *Repeat = GSArgsAfter(Args, "--repeat");
+                char *Warmup = GSArgsAfter(Args, "--warmup");
+                Bench(BenchNames, Lispy,
+                      Size ? strtoul(Size, GSNullPtr, 10) : 1000,
+                      Repeat ? strtoul(Repeat, GSNullPtr, 10) : 10,
+                      Warmup ? strtoul(Warmup, GSNullPtr, 10) : 2);
+                mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+                exit(EXIT_SUCCESS);
+        }
+
+        char *TraceFile = GSArgsAfter(Args, "--trace");
+        if(TraceFile != GSNullPtr) LtraceStart(TraceFile);
+
+        char *MemoLimit = GSArgsAfter(Args, "--memo");
+        if(MemoLimit != GSNullPtr) LmemoLimit = strtoul(MemoLimit, GSNullPtr, 10);
+
+        char *JitThreshold = GSArgsAfter(Args, "--jit");
+        if(JitThreshold != GSNullPtr) LjitThreshold = strtoul(JitThreshold, GSNullPtr, 10);
+
+        char *SampleHertz = GSArgsAfter(Args, "--sample-hz");
+        if(SampleHertz != GSNullPtr) LprofileHertz = strtoul(SampleHertz, GSNullPtr, 10);
+        LprofileFile = GSArgsAfter(Args, "--profile");
+        if(LprofileFile != GSNullPtr) LprofileStart();
+
+        if(GSArgsIsPresent(Args, "--perf-counters") && !LcounterOpen())
+        {
+                fprintf(stderr, "Couldn't open perf counters: %s\n", strerror(errno));
+        }
+        LhistogramEnabled = GSArgsIsPresent(Args, "--latency");
+
+        char *FuelLimit = GSArgsAfter(Args, "--fuel");
+        if(FuelLimit != GSNullPtr) LgovernorFuelLimit = strtoull(FuelLimit, GSNullPtr, 10);
+        char *ByteLimit = GSArgsAfter(Args, "--max-bytes");
+        if(ByteLimit != GSNullPtr) LgovernorByteLimit = strtoull(ByteLimit, GSNullPtr, 10);
+
+        char *ReclaimMaxPending = GSArgsAfterExact(Args, "--reclaim-max-pending");
+        if(ReclaimMaxPending != GSNullPtr) LreclaimMaxPending = strtoull(ReclaimMaxPending, GSNullPtr, 10);
+        char *ReclaimThreshold = GSArgsAfterExact(Args, "--reclaim");
+        if(ReclaimThreshold != GSNullPtr) LreclaimStart(strtoull(ReclaimThreshold, GSNullPtr, 10));
 
-        mpc_result_t *MpcResult = alloca(sizeof(mpc_result_t));
         lenv *Env = LenvNew();
         LenvAddBuiltIns(Env);
 
-        while(true)
+        int Status = EXIT_SUCCESS;
+        char *ScriptFile = GSArgsAfter(Args, "--script");
+        char *CacheDir = GSArgsAfter(Args, "--cache-dir");
+        char *EmitFile = GSArgsAfter(Args, "--emit-c");
+        char *ReplayFile = GSArgsAfter(Args, "--replay");
+        if(ScriptFile != GSNullPtr && EmitFile != GSNullPtr)
         {
-                char *Input = readline("lispy> ");
-                add_history(Input);
-                if(mpc_parse("<stdin>", Input, Lispy, MpcResult))
+                lval *Program = ScriptRead(ScriptFile, GrammarFile, CacheDir, Lispy);
+                if(Program == GSNullPtr || !EmitC(Env, Program, ScriptFile, EmitFile))
                 {
-                        lval *Result = LvalRead(MpcResult->output);
-                        Result = LispEval(Env, Result);
-                        LvalPrintLine(Result);
-                        LvalFree(Result);
-                        mpc_ast_delete(MpcResult->output);
+                        if(Program != GSNullPtr) fprintf(stderr, "Couldn't write %s\n", EmitFile);
+                        Status = EXIT_FAILURE;
+                }
+                if(Program != GSNullPtr) LvalFree(Program);
+        }
+        else if(ScriptFile != GSNullPtr)
+        {
+                char *Repeat = GSArgsAfter(Args, "--repeat");
+                if(!ScriptRun(Env, Lispy, GrammarFile, ScriptFile, CacheDir,
+                              Repeat ? strtoul(Repeat, GSNullPtr, 10) : 1)) Status = EXIT_FAILURE;
+        }
+        else if(ReplayFile != GSNullPtr)
+        {
+                if(!Replay(Env, Lispy, ReplayFile, GSArgsIsPresent(Args, "--paced"))) Status = EXIT_FAILURE;
+        }
+        else
+        {
+                char *RecordFile = GSArgsAfter(Args, "--record");
+                if(RecordFile != GSNullPtr && !LrecordOpen(RecordFile))
+                {
+                        fprintf(stderr, "Couldn't open recording %s\n", RecordFile);
+                        Status = EXIT_FAILURE;
                 }
                 else
                 {
-                        mpc_err_print(MpcResult->error);
-                        mpc_err_delete(MpcResult->error);
+                        Repl(Env, Lispy);
+                        if(!LrecordClose()) fprintf(stderr, "Couldn't write recording %s\n", RecordFile);
                 }
-                free(Input);
         }
 
+        if(LreclaimThreshold != 0) LreclaimPrint(stderr);
+        LreclaimStop();
+
+        BuiltInStatsPrint(stderr);
+        if(LmemoLimit != 0) LmemoPrint(stderr);
+        if(LjitThreshold != 0) LjitPrint(stderr);
+        if(LcounterEnabled) LcounterPrint(stderr);
+        if(LhistogramEnabled) LhistogramPrint(stderr);
+        LcounterClose();
+        if(LprofileEnabled)
+        {
+                if(LprofileStop()) LprofilePrint(stderr);
+                else fprintf(stderr, "Couldn't write profile %s\n", LprofileFile);
+        }
+        if(LtraceEnabled && !LtraceDump()) fprintf(stderr, "Couldn't write trace file %s\n", LtraceFile);
+
+        LmemoClear();
         LenvFree(Env);
-        mpc_cleanup(4, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+        LjitClear();
+        LenvFramePoolFree();
+        mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
 
-        return(0);
+        return(Status);
 }
+#endif
@@ -1,5 +1,25 @@
 #include "mpc.h"
 
+/*
+** Allocation Hooks
+**
+** When built with MPC_ALLOC_HOOKS every
+** allocation goes through the application's
+** hooks, tagged with the section of mpc that
+** made it. `free` is replaced as a plain name
+** because it is also passed around as a
+** destructor.
+*/
+
+#ifdef MPC_ALLOC_HOOKS
+#define malloc(n) mpc_hook_malloc(MPC_ALLOC_TAG, (n))
+#define calloc(n, m) mpc_hook_calloc(MPC_ALLOC_TAG, (n), (m))
+#define realloc(p, n) mpc_hook_realloc(MPC_ALLOC_TAG, (p), (n))
+#define free mpc_hook_free
+#endif
+
+#define MPC_ALLOC_TAG MPC_ALLOC_PARSER
+
 /*
 ** State Type
 */
@@ -24,6 +44,9 @@ static mpc_state_t mpc_state_new(void) {
 ** Input Type
 */
 
+#undef MPC_ALLOC_TAG
+#define MPC_ALLOC_TAG MPC_ALLOC_INPUT
+
 /*
 ** In mpc the input type has three modes of 
 ** operation: String, File and Pipe.
@@ -546,6 +569,9 @@ static mpc_state_t *mpc_input_state_copy(mpc_input_t *i) {
 ** Error Type
 */
 
+#undef MPC_ALLOC_TAG
+#define MPC_ALLOC_TAG MPC_ALLOC_ERROR
+
 void mpc_err_delete(mpc_err_t *x) {
   int i;
   for (i = 0; i < x->expected_num; i++) { free(x->expected[i]); }
@@ -854,6 +880,9 @@ static mpc_err_t *mpc_err_merge(mpc_input_t *i, mpc_err_t *x, mpc_err_t *y) {
 ** Parser Type
 */
 
+#undef MPC_ALLOC_TAG
+#define MPC_ALLOC_TAG MPC_ALLOC_PARSER
+
 enum {
   MPC_TYPE_UNDEFINED = 0,
   MPC_TYPE_PASS      = 1,
@@ -2223,6 +2252,72 @@ mpc_parser_t *mpc_re(const char *re) {
   
 }
 
+/*
+** Decimal Conversion
+*/
+
+/*
+** `mpc_strtol_dec` converts a decimal literal
+** that a parser has already validated, such as
+** a match of /-?[0-9]+/. Unlike `strtol` it does
+** no locale, whitespace or base handling and
+** does not need the length up front.
+**
+** At most 19 significant digits fit in a long,
+** and 19 digits always fit in an unsigned 64 bit
+** accumulator, so overflow is detected exactly
+** with one comparison at the end. Runs of eight
+** digits are converted together with SWAR
+** multiplies on little endian machines.
+*/
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MPC_SWAR_DECIMAL
+#endif
+
+#ifdef MPC_SWAR_DECIMAL
+static unsigned long long mpc_swar_digits8(const char *s) {
+  unsigned long long v;
+  memcpy(&v, s, 8);
+  v = ((v & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+  v = ((v & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+  return ((v & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+}
+#endif
+
+int mpc_strtol_dec(const char *s, long *out) {
+  
+  int neg = 0;
+  size_t n = 0;
+  unsigned long long v = 0;
+  unsigned long long limit;
+  
+  if (*s == '-') { neg = 1; s++; }
+  while (*s == '0') { s++; }
+  
+  /* Bounded scan; a 20th digit means overflow. */
+  while (n < 20 && s[n] >= '0' && s[n] <= '9') { n++; }
+  if (n == 20) { return 0; }
+  
+#ifdef MPC_SWAR_DECIMAL
+  while (n >= 8) {
+    v = v * 100000000ULL + mpc_swar_digits8(s);
+    s += 8; n -= 8;
+  }
+#endif
+  
+  while (n > 0) {
+    v = v * 10 + (unsigned long long)(*s - '0');
+    s++; n--;
+  }
+  
+  limit = (unsigned long long)LONG_MAX + (unsigned long long)neg;
+  if (v > limit) { return 0; }
+  
+  *out = neg ? (long)(0ULL - v) : (long)v;
+  return 1;
+}
+
 /*
 ** Common Fold Functions
 */
@@ -2234,8 +2329,10 @@ mpc_val_t *mpcf_ctor_str(void) { return calloc(1, 1); }
 mpc_val_t *mpcf_free(mpc_val_t *x) { free(x); return NULL; }
 
 mpc_val_t *mpcf_int(mpc_val_t *x) {
+  long l;
   int *y = malloc(sizeof(int));
-  *y = strtol(x, NULL, 10);
+  if (!mpc_strtol_dec(x, &l)) { l = ((char*)x)[0] == '-' ? LONG_MIN : LONG_MAX; }
+  *y = l;
   free(x);
   return y;
 }
@@ -2665,21 +2762,41 @@ int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
 ** AST
 */
 
+#undef MPC_ALLOC_TAG
+#define MPC_ALLOC_TAG MPC_ALLOC_AST
+
+/*
+** Deletes without recursion. Children are deleted from the last one down and
+** the slot each leaves behind holds the pointer back to its parent, so a
+** node's parent is always at children[children_num].
+*/
 void mpc_ast_delete(mpc_ast_t *a) {
   
-  int i;
+  mpc_ast_t *parent = NULL;
+  mpc_ast_t *child;
   
   if (a == NULL) { return; }
   
-  for (i = 0; i < a->children_num; i++) {
-    mpc_ast_delete(a->children[i]);
+  while (1) {
+    
+    if (a->children_num > 0) {
+      child = a->children[--a->children_num];
+      a->children[a->children_num] = parent;
+      parent = a;
+      a = child;
+      continue;
+    }
+    
+    free(a->children);
+    free(a->tag);
+    free(a->contents);
+    free(a);
+    
+    if (parent == NULL) { return; }
+    a = parent;
+    parent = a->children[a->children_num];
   }
   
-  free(a->children);
-  free(a->tag);
-  free(a->contents);
-  free(a);
-  
 }
 
 static void mpc_ast_delete_no_children(mpc_ast_t *a) {
@@ -3118,6 +3235,9 @@ mpc_parser_t *mpca_total(mpc_parser_t *a) { return mpc_total(a, (mpc_dtor_t)mpc_
 ** Grammar Parser
 */
 
+#undef MPC_ALLOC_TAG
+#define MPC_ALLOC_TAG MPC_ALLOC_PARSER
+
 /*
 ** This is another interesting bootstrapping.
 **
@@ -3828,3 +3948,660 @@ void mpc_optimise(mpc_parser_t *p) {
   mpc_optimise_unretained(p, 1);
 }
 
+
+/*
+** Precompiled Parsers
+*/
+
+/*
+** Building a parser with `mpca_lang` means
+** bootstrapping the grammar grammar, running
+** `mpc_re` for every regex literal and then
+** optimising the result. For short lived
+** processes this can dominate start up time.
+**
+** `mpc_save` writes the graph reachable from
+** a set of retained parsers into a flat binary
+** blob. Nodes are numbered and child pointers
+** become node indices. Function pointers are
+** stored as indices into a table of the fold,
+** apply and destructor functions that mpc
+** itself uses, so a blob is valid across runs
+** and across address space randomisation.
+**
+** `mpc_load` validates the whole blob first and
+** only then allocates nodes and patches the
+** indices back into pointers. If anything is
+** wrong with the blob an error is returned and
+** the supplied parsers are left untouched, so
+** callers can fall back to `mpca_lang`.
+**
+** Only graphs built from mpc's own functions
+** can be saved. Parsers using user callbacks
+** or lifted values will fail with an error.
+*/
+
+enum {
+  MPC_BLOB_VERSION  = 1,
+  MPC_BLOB_NULL     = 0xFFFFFFFF,
+  MPC_BLOB_TAG_NONE = 0,
+  MPC_BLOB_TAG_NAME = 1,
+  MPC_BLOB_TAG_LIT  = 2
+};
+
+static const char mpc_blob_magic[4] = { 'M', 'P', 'C', 'B' };
+
+typedef void(*mpc_blob_func_t)(void);
+
+static mpc_blob_func_t mpc_blob_funcs[] = {
+  (mpc_blob_func_t)free,
+  (mpc_blob_func_t)mpc_soft_delete,
+  (mpc_blob_func_t)mpc_soi_anchor,
+  (mpc_blob_func_t)mpc_eoi_anchor,
+  (mpc_blob_func_t)mpc_boundary_anchor,
+  (mpc_blob_func_t)mpcf_dtor_null,
+  (mpc_blob_func_t)mpcf_ctor_null,
+  (mpc_blob_func_t)mpcf_ctor_str,
+  (mpc_blob_func_t)mpcf_free,
+  (mpc_blob_func_t)mpcf_int,
+  (mpc_blob_func_t)mpcf_hex,
+  (mpc_blob_func_t)mpcf_oct,
+  (mpc_blob_func_t)mpcf_float,
+  (mpc_blob_func_t)mpcf_strtriml,
+  (mpc_blob_func_t)mpcf_strtrimr,
+  (mpc_blob_func_t)mpcf_strtrim,
+  (mpc_blob_func_t)mpcf_escape,
+  (mpc_blob_func_t)mpcf_escape_regex,
+  (mpc_blob_func_t)mpcf_escape_string_raw,
+  (mpc_blob_func_t)mpcf_escape_char_raw,
+  (mpc_blob_func_t)mpcf_unescape,
+  (mpc_blob_func_t)mpcf_unescape_regex,
+  (mpc_blob_func_t)mpcf_unescape_string_raw,
+  (mpc_blob_func_t)mpcf_unescape_char_raw,
+  (mpc_blob_func_t)mpcf_null,
+  (mpc_blob_func_t)mpcf_fst,
+  (mpc_blob_func_t)mpcf_snd,
+  (mpc_blob_func_t)mpcf_trd,
+  (mpc_blob_func_t)mpcf_fst_free,
+  (mpc_blob_func_t)mpcf_snd_free,
+  (mpc_blob_func_t)mpcf_trd_free,
+  (mpc_blob_func_t)mpcf_strfold,
+  (mpc_blob_func_t)mpcf_maths,
+  (mpc_blob_func_t)mpcf_fold_ast,
+  (mpc_blob_func_t)mpcf_str_ast,
+  (mpc_blob_func_t)mpcf_state_ast,
+  (mpc_blob_func_t)mpc_ast_delete,
+  (mpc_blob_func_t)mpc_ast_tag,
+  (mpc_blob_func_t)mpc_ast_add_tag,
+  (mpc_blob_func_t)mpc_ast_add_root
+};
+
+/* Tags attached by `mpcaf_grammar_string` and friends. */
+static const char *mpc_blob_tags[] = { "string", "char", "regex" };
+
+typedef struct {
+  int num;
+  int slots;
+  mpc_parser_t **ps;
+} mpc_blob_nodes_t;
+
+typedef struct {
+  size_t len;
+  size_t slots;
+  unsigned char *data;
+} mpc_blob_out_t;
+
+typedef struct {
+  const unsigned char *data;
+  size_t len;
+  size_t pos;
+  int failed;
+} mpc_blob_in_t;
+
+static int mpc_blob_func_index(mpc_blob_func_t f, unsigned int *out) {
+  unsigned int i;
+  if (f == NULL) { *out = MPC_BLOB_NULL; return 1; }
+  for (i = 0; i < sizeof(mpc_blob_funcs) / sizeof(mpc_blob_funcs[0]); i++) {
+    if (mpc_blob_funcs[i] == f) { *out = i; return 1; }
+  }
+  return 0;
+}
+
+static int mpc_blob_node_index(mpc_blob_nodes_t *ns, mpc_parser_t *p) {
+  int i;
+  for (i = 0; i < ns->num; i++) {
+    if (ns->ps[i] == p) { return i; }
+  }
+  return -1;
+}
+
+static void mpc_blob_node_add(mpc_blob_nodes_t *ns, mpc_parser_t *p) {
+  if (mpc_blob_node_index(ns, p) >= 0) { return; }
+  if (ns->num == ns->slots) {
+    ns->slots = ns->slots ? ns->slots * 2 : 64;
+    ns->ps = realloc(ns->ps, sizeof(mpc_parser_t*) * ns->slots);
+  }
+  ns->ps[ns->num++] = p;
+}
+
+/* Breadth first, so roots keep the first indices. */
+static void mpc_blob_collect(mpc_blob_nodes_t *ns) {
+  
+  int i, j;
+  mpc_parser_t *p;
+  
+  for (i = 0; i < ns->num; i++) {
+    p = ns->ps[i];
+    switch (p->type) {
+      case MPC_TYPE_EXPECT:   mpc_blob_node_add(ns, p->data.expect.x);   break;
+      case MPC_TYPE_APPLY:    mpc_blob_node_add(ns, p->data.apply.x);    break;
+      case MPC_TYPE_APPLY_TO: mpc_blob_node_add(ns, p->data.apply_to.x); break;
+      case MPC_TYPE_PREDICT:  mpc_blob_node_add(ns, p->data.predict.x);  break;
+      case MPC_TYPE_NOT:
+      case MPC_TYPE_MAYBE:    mpc_blob_node_add(ns, p->data.not.x);      break;
+      case MPC_TYPE_MANY:
+      case MPC_TYPE_MANY1:
+      case MPC_TYPE_COUNT:    mpc_blob_node_add(ns, p->data.repeat.x);   break;
+      case MPC_TYPE_OR:
+        for (j = 0; j < p->data.or.n; j++) { mpc_blob_node_add(ns, p->data.or.xs[j]); }
+        break;
+      case MPC_TYPE_AND:
+        for (j = 0; j < p->data.and.n; j++) { mpc_blob_node_add(ns, p->data.and.xs[j]); }
+        break;
+      default: break;
+    }
+  }
+  
+}
+
+static void mpc_blob_put(mpc_blob_out_t *o, const void *x, size_t n) {
+  if (o->len + n > o->slots) {
+    o->slots = (o->len + n) * 2;
+    o->data = realloc(o->data, o->slots);
+  }
+  memcpy(o->data + o->len, x, n);
+  o->len += n;
+}
+
+static void mpc_blob_put_u8(mpc_blob_out_t *o, unsigned int x) {
+  unsigned char b = (unsigned char)x;
+  mpc_blob_put(o, &b, 1);
+}
+
+static void mpc_blob_put_u32(mpc_blob_out_t *o, unsigned long x) {
+  unsigned char b[4];
+  b[0] = (unsigned char)(x >>  0);
+  b[1] = (unsigned char)(x >>  8);
+  b[2] = (unsigned char)(x >> 16);
+  b[3] = (unsigned char)(x >> 24);
+  mpc_blob_put(o, b, 4);
+}
+
+static void mpc_blob_put_str(mpc_blob_out_t *o, const char *s) {
+  if (s == NULL) { mpc_blob_put_u32(o, MPC_BLOB_NULL); return; }
+  mpc_blob_put_u32(o, strlen(s));
+  mpc_blob_put(o, s, strlen(s));
+}
+
+static int mpc_blob_put_func(mpc_blob_out_t *o, mpc_blob_func_t f) {
+  unsigned int x;
+  if (!mpc_blob_func_index(f, &x)) { return 0; }
+  mpc_blob_put_u32(o, x);
+  return 1;
+}
+
+static void mpc_blob_put_node(mpc_blob_out_t *o, mpc_blob_nodes_t *ns, mpc_parser_t *p) {
+  mpc_blob_put_u32(o, mpc_blob_node_index(ns, p));
+}
+
+static int mpc_blob_put_tag(mpc_blob_out_t *o, mpc_blob_nodes_t *ns, int roots, const char *t) {
+  
+  int i;
+  
+  if (t == NULL) { mpc_blob_put_u8(o, MPC_BLOB_TAG_NONE); return 1; }
+  
+  for (i = 0; i < roots; i++) {
+    if (ns->ps[i]->name == t) {
+      mpc_blob_put_u8(o, MPC_BLOB_TAG_NAME);
+      mpc_blob_put_u32(o, i);
+      return 1;
+    }
+  }
+  
+  for (i = 0; i < (int)(sizeof(mpc_blob_tags) / sizeof(mpc_blob_tags[0])); i++) {
+    if (strcmp(mpc_blob_tags[i], t) == 0) {
+      mpc_blob_put_u8(o, MPC_BLOB_TAG_LIT);
+      mpc_blob_put_u32(o, i);
+      return 1;
+    }
+  }
+  
+  return 0;
+}
+
+static const char *mpc_blob_write(mpc_blob_out_t *o, mpc_blob_nodes_t *ns, int roots) {
+  
+  int i, j;
+  mpc_parser_t *p;
+  
+  mpc_blob_put(o, mpc_blob_magic, 4);
+  mpc_blob_put_u32(o, MPC_BLOB_VERSION);
+  mpc_blob_put_u32(o, roots);
+  mpc_blob_put_u32(o, ns->num);
+  
+  for (i = 0; i < ns->num; i++) {
+    
+    p = ns->ps[i];
+    
+    if (p->retained && i >= roots) { return "Grammar refers to a parser that was not supplied!"; }
+    
+    mpc_blob_put_u8(o, p->type);
+    mpc_blob_put_str(o, p->name);
+    
+    switch (p->type) {
+      
+      case MPC_TYPE_UNDEFINED:
+      case MPC_TYPE_PASS:
+      case MPC_TYPE_STATE:
+      case MPC_TYPE_ANY:
+        break;
+      
+      case MPC_TYPE_FAIL: mpc_blob_put_str(o, p->data.fail.m); break;
+      
+      case MPC_TYPE_LIFT:
+        if (!mpc_blob_put_func(o, (mpc_blob_func_t)p->data.lift.lf)) { return "Unknown lift function!"; }
+        break;
+      
+      case MPC_TYPE_LIFT_VAL:
+        if (p->data.lift.x != NULL) { return "Lifted values cannot be saved!"; }
+        break;
+      
+      case MPC_TYPE_EXPECT:
+        mpc_blob_put_node(o, ns, p->data.expect.x);
+        mpc_blob_put_str(o, p->data.expect.m);
+        break;
+      
+      case MPC_TYPE_ANCHOR:
+        if (!mpc_blob_put_func(o, (mpc_blob_func_t)p->data.anchor.f)) { return "Unknown anchor function!"; }
+        break;
+      
+      case MPC_TYPE_SINGLE: mpc_blob_put_u8(o, (unsigned char)p->data.single.x); break;
+      
+      case MPC_TYPE_RANGE:
+        mpc_blob_put_u8(o, (unsigned char)p->data.range.x);
+        mpc_blob_put_u8(o, (unsigned char)p->data.range.y);
+        break;
+      
+      case MPC_TYPE_SATISFY: return "Satisfy parsers cannot be saved!";
+      
+      case MPC_TYPE_ONEOF:
+      case MPC_TYPE_NONEOF:
+      case MPC_TYPE_STRING:
+        mpc_blob_put_str(o, p->data.string.x);
+        break;
+      
+      case MPC_TYPE_APPLY:
+        mpc_blob_put_node(o, ns, p->data.apply.x);
+        if (!mpc_blob_put_func(o, (mpc_blob_func_t)p->data.apply.f)) { return "Unknown apply function!"; }
+        break;
+      
+      case MPC_TYPE_APPLY_TO:
+        mpc_blob_put_node(o, ns, p->data.apply_to.x);
+        if (!mpc_blob_put_func(o, (mpc_blob_func_t)p->data.apply_to.f)) { return "Unknown apply function!"; }
+        if (!mpc_blob_put_tag(o, ns, roots, p->data.apply_to.d)) { return "Unknown apply data!"; }
+        break;
+      
+      case MPC_TYPE_PREDICT: mpc_blob_put_node(o, ns, p->data.predict.x); break;
+      
+      case MPC_TYPE_NOT:
+      case MPC_TYPE_MAYBE:
+        mpc_blob_put_node(o, ns, p->data.not.x);
+        if (!mpc_blob_put_func(o, (mpc_blob_func_t)p->data.not.dx)
+        ||  !mpc_blob_put_func(o, (mpc_blob_func_t)p->data.not.lf)) { return "Unknown not function!"; }
+        break;
+      
+      case MPC_TYPE_MANY:
+      case MPC_TYPE_MANY1:
+      case MPC_TYPE_COUNT:
+        mpc_blob_put_u32(o, p->data.repeat.n);
+        mpc_blob_put_node(o, ns, p->data.repeat.x);
+        if (!mpc_blob_put_func(o, (mpc_blob_func_t)p->data.repeat.f)
+        ||  !mpc_blob_put_func(o, (mpc_blob_func_t)p->data.repeat.dx)) { return "Unknown repeat function!"; }
+        break;
+      
+      case MPC_TYPE_OR:
+        mpc_blob_put_u32(o, p->data.or.n);
+        for (j = 0; j < p->data.or.n; j++) { mpc_blob_put_node(o, ns, p->data.or.xs[j]); }
+        break;
+      
+      case MPC_TYPE_AND:
+        mpc_blob_put_u32(o, p->data.and.n);
+        if (!mpc_blob_put_func(o, (mpc_blob_func_t)p->data.and.f)) { return "Unknown fold function!"; }
+        for (j = 0; j < p->data.and.n; j++) { mpc_blob_put_node(o, ns, p->data.and.xs[j]); }
+        for (j = 0; j < p->data.and.n-1; j++) {
+          if (!mpc_blob_put_func(o, (mpc_blob_func_t)p->data.and.dxs[j])) { return "Unknown destructor!"; }
+        }
+        break;
+      
+      default: return "Unknown Parser Type Id!";
+    }
+  }
+  
+  return NULL;
+}
+
+mpc_err_t *mpc_save(const char *filename, int n, ...) {
+  
+  int i;
+  FILE *f;
+  const char *failure;
+  mpc_blob_nodes_t ns;
+  mpc_blob_out_t o;
+  
+  va_list va;
+  
+  ns.num = 0; ns.slots = 0; ns.ps = NULL;
+  o.len = 0; o.slots = 0; o.data = NULL;
+  
+  va_start(va, n);
+  for (i = 0; i < n; i++) { mpc_blob_node_add(&ns, va_arg(va, mpc_parser_t*)); }
+  va_end(va);
+  
+  if (ns.num != n) { free(ns.ps); return mpc_err_file(filename, "Parser supplied more than once!"); }
+  
+  mpc_blob_collect(&ns);
+  failure = mpc_blob_write(&o, &ns, n);
+  free(ns.ps);
+  
+  if (failure != NULL) { free(o.data); return mpc_err_file(filename, failure); }
+  
+  f = fopen(filename, "wb");
+  if (f == NULL) { free(o.data); return mpc_err_file(filename, "Unable to open file!"); }
+  
+  if (fwrite(o.data, 1, o.len, f) != o.len) {
+    fclose(f); free(o.data);
+    return mpc_err_file(filename, "Unable to write file!");
+  }
+  
+  fclose(f);
+  free(o.data);
+  return NULL;
+}
+
+static const unsigned char *mpc_blob_get(mpc_blob_in_t *in, size_t n) {
+  const unsigned char *x;
+  if (in->failed || n > in->len - in->pos) { in->failed = 1; return NULL; }
+  x = in->data + in->pos;
+  in->pos += n;
+  return x;
+}
+
+static unsigned int mpc_blob_get_u8(mpc_blob_in_t *in) {
+  const unsigned char *b = mpc_blob_get(in, 1);
+  return b ? b[0] : 0;
+}
+
+static unsigned long mpc_blob_get_u32(mpc_blob_in_t *in) {
+  const unsigned char *b = mpc_blob_get(in, 4);
+  if (b == NULL) { return 0; }
+  return ((unsigned long)b[0] <<  0) | ((unsigned long)b[1] <<  8)
+       | ((unsigned long)b[2] << 16) | ((unsigned long)b[3] << 24);
+}
+
+static char *mpc_blob_get_str(mpc_blob_in_t *in, int alloc) {
+  
+  char *s;
+  const unsigned char *b;
+  unsigned long l = mpc_blob_get_u32(in);
+  
+  if (l == MPC_BLOB_NULL) { return NULL; }
+  b = mpc_blob_get(in, l);
+  if (b == NULL || !alloc) { return NULL; }
+  
+  s = malloc(l + 1);
+  memcpy(s, b, l);
+  s[l] = '\0';
+  return s;
+}
+
+static mpc_blob_func_t mpc_blob_get_func(mpc_blob_in_t *in) {
+  unsigned long x = mpc_blob_get_u32(in);
+  if (x == MPC_BLOB_NULL) { return NULL; }
+  if (x >= sizeof(mpc_blob_funcs) / sizeof(mpc_blob_funcs[0])) { in->failed = 1; return NULL; }
+  return mpc_blob_funcs[x];
+}
+
+static mpc_parser_t *mpc_blob_get_node(mpc_blob_in_t *in, mpc_parser_t **ps, unsigned long num) {
+  unsigned long x = mpc_blob_get_u32(in);
+  if (x >= num) { in->failed = 1; return NULL; }
+  return ps ? ps[x] : NULL;
+}
+
+static void *mpc_blob_get_tag(mpc_blob_in_t *in, mpc_parser_t **ps, unsigned long roots) {
+  
+  unsigned long x;
+  unsigned int kind = mpc_blob_get_u8(in);
+  
+  if (kind == MPC_BLOB_TAG_NONE) { return NULL; }
+  
+  x = mpc_blob_get_u32(in);
+  
+  if (kind == MPC_BLOB_TAG_NAME && x < roots) {
+    return ps ? ps[x]->name : NULL;
+  }
+  
+  if (kind == MPC_BLOB_TAG_LIT && x < sizeof(mpc_blob_tags) / sizeof(mpc_blob_tags[0])) {
+    return (void*)mpc_blob_tags[x];
+  }
+  
+  in->failed = 1;
+  return NULL;
+}
+
+/*
+** Reads every node. The first pass only checks
+** the blob, including that each root's name
+** matches the supplied parser. The second pass
+** fills in `ps` and cannot fail.
+*/
+
+static int mpc_blob_read(mpc_blob_in_t *in, mpc_parser_t **ps, unsigned long num, unsigned long roots, int fill) {
+  
+  unsigned long i;
+  int j;
+  char *name;
+  mpc_parser_t *p, *x, dummy;
+  mpc_parser_t **fps = fill ? ps : NULL;
+  mpc_dtor_t dx;
+  
+  for (i = 0; i < num && !in->failed; i++) {
+    
+    p = fill ? ps[i] : &dummy;
+    p->type = (char)mpc_blob_get_u8(in);
+    
+    name = mpc_blob_get_str(in, i < roots ? !fill : fill);
+    if (i < roots && !fill) {
+      if (name == NULL || ps[i]->name == NULL || strcmp(name, ps[i]->name) != 0) { in->failed = 1; }
+      free(name);
+    }
+    if (i >= roots && fill) { p->name = name; }
+    
+    switch (p->type) {
+      
+      case MPC_TYPE_UNDEFINED:
+      case MPC_TYPE_PASS:
+      case MPC_TYPE_STATE:
+      case MPC_TYPE_ANY:
+        break;
+      
+      case MPC_TYPE_FAIL: p->data.fail.m = mpc_blob_get_str(in, fill); break;
+      
+      case MPC_TYPE_LIFT: p->data.lift.lf = (mpc_ctor_t)mpc_blob_get_func(in); break;
+      
+      case MPC_TYPE_LIFT_VAL: p->data.lift.x = NULL; break;
+      
+      case MPC_TYPE_EXPECT:
+        p->data.expect.x = mpc_blob_get_node(in, fps, num);
+        p->data.expect.m = mpc_blob_get_str(in, fill);
+        break;
+      
+      case MPC_TYPE_ANCHOR:
+        p->data.anchor.f = (int(*)(char,char))mpc_blob_get_func(in);
+        break;
+      
+      case MPC_TYPE_SINGLE: p->data.single.x = (char)mpc_blob_get_u8(in); break;
+      
+      case MPC_TYPE_RANGE:
+        p->data.range.x = (char)mpc_blob_get_u8(in);
+        p->data.range.y = (char)mpc_blob_get_u8(in);
+        break;
+      
+      case MPC_TYPE_ONEOF:
+      case MPC_TYPE_NONEOF:
+      case MPC_TYPE_STRING:
+        p->data.string.x = mpc_blob_get_str(in, fill);
+        break;
+      
+      case MPC_TYPE_APPLY:
+        p->data.apply.x = mpc_blob_get_node(in, fps, num);
+        p->data.apply.f = (mpc_apply_t)mpc_blob_get_func(in);
+        break;
+      
+      case MPC_TYPE_APPLY_TO:
+        p->data.apply_to.x = mpc_blob_get_node(in, fps, num);
+        p->data.apply_to.f = (mpc_apply_to_t)mpc_blob_get_func(in);
+        p->data.apply_to.d = mpc_blob_get_tag(in, ps, roots);
+        break;
+      
+      case MPC_TYPE_PREDICT: p->data.predict.x = mpc_blob_get_node(in, fps, num); break;
+      
+      case MPC_TYPE_NOT:
+      case MPC_TYPE_MAYBE:
+        p->data.not.x = mpc_blob_get_node(in, fps, num);
+        p->data.not.dx = (mpc_dtor_t)mpc_blob_get_func(in);
+        p->data.not.lf = (mpc_ctor_t)mpc_blob_get_func(in);
+        break;
+      
+      case MPC_TYPE_MANY:
+      case MPC_TYPE_MANY1:
+      case MPC_TYPE_COUNT:
+        p->data.repeat.n = (int)mpc_blob_get_u32(in);
+        p->data.repeat.x = mpc_blob_get_node(in, fps, num);
+        p->data.repeat.f = (mpc_fold_t)mpc_blob_get_func(in);
+        p->data.repeat.dx = (mpc_dtor_t)mpc_blob_get_func(in);
+        break;
+      
+      case MPC_TYPE_OR:
+        p->data.or.n = (int)mpc_blob_get_u32(in);
+        if (p->data.or.n < 0 || (unsigned long)p->data.or.n > in->len) { in->failed = 1; break; }
+        p->data.or.xs = fill ? malloc(sizeof(mpc_parser_t*) * p->data.or.n) : NULL;
+        for (j = 0; j < p->data.or.n; j++) {
+          x = mpc_blob_get_node(in, fps, num);
+          if (fill) { p->data.or.xs[j] = x; }
+        }
+        break;
+      
+      case MPC_TYPE_AND:
+        p->data.and.n = (int)mpc_blob_get_u32(in);
+        if (p->data.and.n < 1 || (unsigned long)p->data.and.n > in->len) { in->failed = 1; break; }
+        p->data.and.f = (mpc_fold_t)mpc_blob_get_func(in);
+        p->data.and.xs = fill ? malloc(sizeof(mpc_parser_t*) * p->data.and.n) : NULL;
+        p->data.and.dxs = fill ? malloc(sizeof(mpc_dtor_t) * (p->data.and.n-1)) : NULL;
+        for (j = 0; j < p->data.and.n; j++) {
+          x = mpc_blob_get_node(in, fps, num);
+          if (fill) { p->data.and.xs[j] = x; }
+        }
+        for (j = 0; j < p->data.and.n-1; j++) {
+          dx = (mpc_dtor_t)mpc_blob_get_func(in);
+          if (fill) { p->data.and.dxs[j] = dx; }
+        }
+        break;
+      
+      default: in->failed = 1; break;
+    }
+  }
+  
+  return !in->failed;
+}
+
+mpc_err_t *mpc_load(const char *filename, int n, ...) {
+  
+  int i;
+  long size;
+  size_t header;
+  unsigned long num, roots;
+  unsigned char *data;
+  mpc_parser_t **ps;
+  mpc_blob_in_t in;
+  
+  va_list va;
+  
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) { return mpc_err_file(filename, "Unable to open file!"); }
+  
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  
+  if (size < 16) { fclose(f); return mpc_err_file(filename, "Not a precompiled grammar!"); }
+  
+  data = malloc(size);
+  if (fread(data, 1, size, f) != (size_t)size) {
+    fclose(f); free(data);
+    return mpc_err_file(filename, "Unable to read file!");
+  }
+  fclose(f);
+  
+  in.data = data;
+  in.len = size;
+  in.pos = 0;
+  in.failed = 0;
+  
+  if (memcmp(mpc_blob_get(&in, 4), mpc_blob_magic, 4) != 0) {
+    free(data);
+    return mpc_err_file(filename, "Not a precompiled grammar!");
+  }
+  
+  if (mpc_blob_get_u32(&in) != MPC_BLOB_VERSION) {
+    free(data);
+    return mpc_err_file(filename, "Precompiled grammar version mismatch!");
+  }
+  
+  roots = mpc_blob_get_u32(&in);
+  num = mpc_blob_get_u32(&in);
+  header = in.pos;
+  
+  if (roots != (unsigned long)n || num < roots || num > in.len) {
+    free(data);
+    return mpc_err_file(filename, "Precompiled grammar does not match parsers!");
+  }
+  
+  ps = malloc(sizeof(mpc_parser_t*) * num);
+  
+  va_start(va, n);
+  for (i = 0; i < n; i++) { ps[i] = va_arg(va, mpc_parser_t*); }
+  va_end(va);
+  
+  for (i = 0; i < n; i++) {
+    if (!ps[i]->retained) {
+      free(ps); free(data);
+      return mpc_err_file(filename, "Precompiled grammar does not match parsers!");
+    }
+  }
+  
+  if (!mpc_blob_read(&in, ps, num, roots, 0)) {
+    free(ps); free(data);
+    return mpc_err_file(filename, "Precompiled grammar is corrupt or does not match parsers!");
+  }
+  
+  /* Validated, so allocate nodes and patch indices into pointers. */
+  for (i = 0; i < n; i++) { mpc_undefine(ps[i]); }
+  for (i = n; (unsigned long)i < num; i++) { ps[i] = mpc_undefined(); }
+  
+  in.pos = header;
+  mpc_blob_read(&in, ps, num, roots, 1);
+  
+  free(ps);
+  free(data);
+  return NULL;
+}
@@ -17,6 +17,7 @@
 #include <math.h>
 #include <errno.h>
 #include <ctype.h>
+#include <limits.h>
 
 /*
 ** State Type
@@ -207,6 +208,12 @@ mpc_parser_t *mpc_tok_braces(mpc_parser_t *a, mpc_dtor_t ad);
 mpc_parser_t *mpc_tok_brackets(mpc_parser_t *a, mpc_dtor_t ad);
 mpc_parser_t *mpc_tok_squares(mpc_parser_t *a, mpc_dtor_t ad);
 
+/*
+** Decimal Conversion
+*/
+
+int mpc_strtol_dec(const char *s, long *out);
+
 /*
 ** Common Function Parameters
 */
@@ -349,6 +356,38 @@ void mpc_print(mpc_parser_t *p);
 void mpc_optimise(mpc_parser_t *p);
 void mpc_stats(mpc_parser_t *p);
 
+/*
+** Precompiled Parsers
+*/
+
+mpc_err_t *mpc_save(const char *filename, int n, ...);
+mpc_err_t *mpc_load(const char *filename, int n, ...);
+
+/*
+** Allocation Hooks
+**
+** Define MPC_ALLOC_HOOKS when compiling mpc.c
+** to route all of its allocations through
+** these functions, which the application must
+** provide. Memory is always released through
+** `mpc_hook_free`, so the hooks may keep a
+** header in front of each block.
+*/
+
+#ifdef MPC_ALLOC_HOOKS
+enum {
+  MPC_ALLOC_PARSER,
+  MPC_ALLOC_INPUT,
+  MPC_ALLOC_ERROR,
+  MPC_ALLOC_AST
+};
+
+void *mpc_hook_malloc(int tag, size_t n);
+void *mpc_hook_calloc(int tag, size_t n, size_t m);
+void *mpc_hook_realloc(int tag, void *p, size_t n);
+void mpc_hook_free(void *p);
+#endif
+
 int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
   int(*tester)(const void*, const void*), 
   mpc_dtor_t destructor, 